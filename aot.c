@@ -0,0 +1,101 @@
+#include "common.h"
+#include "aot.h"
+
+#ifdef AOT_AVAILABLE
+#include <dlfcn.h>
+#endif
+
+static void            *aot_object      = NULL;
+static const aot_block *aot_blocks      = NULL;
+static int             aot_block_count  = 0;
+
+uint64_t aot_hash (const uint8_t *image, uint64_t size) {
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (uint64_t i = 0; i < size; ++i) {
+		hash = (hash ^ image[i])*1099511628211ULL;
+	}
+	return hash;
+}
+
+bool aot_load (const char *path, uint64_t rom_hash, const aot_env *env) {
+#ifdef AOT_AVAILABLE
+	char local[4096];
+
+	aot_unload();
+
+	// a bare file name would make dlopen search the library path instead
+	if (strchr(path, '/') == NULL) {
+		snprintf(local, sizeof(local), "./%s", path);
+		path = local;
+	}
+
+	aot_object = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (aot_object == NULL) {
+		println("Failed to load translated rom \'%s\': %s", path, dlerror());
+		return false;
+	}
+
+	const int       *abi      = dlsym(aot_object, "aot_abi_version");
+	const uint64_t  *hash     = dlsym(aot_object, "aot_rom_hash");
+	const aot_block *blocks   = dlsym(aot_object, "aot_blocks");
+	const int       *count    = dlsym(aot_object, "aot_block_count");
+	void (*bind) (const aot_env *) = (void (*) (const aot_env *)) dlsym(aot_object, "aot_bind");
+
+	if (abi == NULL || hash == NULL || blocks == NULL || count == NULL || bind == NULL) {
+		println("\'%s\' is not a translated rom", path);
+		aot_unload();
+		return false;
+	}
+	if (*abi != AOT_ABI_VERSION) {
+		println("\'%s\' was built for another emulator version", path);
+		aot_unload();
+		return false;
+	}
+	if (*hash != rom_hash) {
+		println("\'%s\' was built from another rom", path);
+		aot_unload();
+		return false;
+	}
+
+	bind(env);
+	aot_blocks      = blocks;
+	aot_block_count = *count;
+	println("Loaded %d translated blocks from \'%s\'", aot_block_count, path);
+	return true;
+#else
+	println("Translated roms are not supported on this host");
+	return false;
+#endif
+}
+
+void aot_unload (void) {
+#ifdef AOT_AVAILABLE
+	if (aot_object != NULL) {
+		dlclose(aot_object);
+	}
+#endif
+	aot_object      = NULL;
+	aot_blocks      = NULL;
+	aot_block_count = 0;
+}
+
+aot_code aot_find (uint32_t offset) {
+	int low  = 0;
+	int high = aot_block_count - 1;
+
+	while (low <= high) {
+		int mid = (low + high)/2;
+
+		if (aot_blocks[mid].offset == offset) {
+			return aot_blocks[mid].code;
+		}
+		if (aot_blocks[mid].offset < offset) {
+			low = mid + 1;
+		}
+		else {
+			high = mid - 1;
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,59 @@
+#ifndef _AOT_H_
+#define _AOT_H_
+
+#include <stddef.h>
+
+#include "cpu_state.h"
+
+/*
+ * Ahead of time translated ROM code. cpu_aot_generate writes one C function
+ * per ROM block, tools/aot.sh builds them into a shared object and --aot
+ * loads it. Generated code includes nothing but this header, so everything
+ * the emulator and the object have to agree on lives here.
+ */
+#if !defined(__EMSCRIPTEN__) && !defined(_WIN32)
+#define AOT_AVAILABLE
+#endif
+
+#define AOT_ABI_VERSION 5
+
+typedef void (*aot_handler) (int *cycles);
+
+typedef void (*aot_code) (void);
+
+// handed to the object once it is loaded
+typedef struct {
+	cpu_state         *cpu;
+	void *const       *current;  // running block, the object has to leave when it changes
+	const aot_handler *main_ops; // handler per opcode
+	const aot_handler *cb_ops;   // handler per CB prefixed opcode
+	uint64_t          *instructions; // retired guest instructions, bumped before each op runs
+	uint8_t           *coverage;      // coverage bitmap, NULL while not recording
+	uint32_t          *coverage_hits; // per byte counters, NULL unless built with COVERAGE_COUNTS
+} aot_env;
+
+typedef struct {
+	uint32_t offset; // rom image offset of the first opcode, bank*0x4000 + pc%0x4000
+	aot_code code;
+} aot_block;
+
+/*
+ * Every object exports:
+ * const int       aot_abi_version;
+ * const uint64_t  aot_rom_hash;     // aot_hash of the whole rom image
+ * const aot_block aot_blocks[];     // sorted by offset
+ * const int       aot_block_count;
+ * void            aot_bind (const aot_env *env);
+ */
+
+// the header checksum is shared by most homebrew and hacks, so objects are tied to the full image
+uint64_t aot_hash (const uint8_t *image, uint64_t size);
+
+bool aot_load (const char *path, uint64_t rom_hash, const aot_env *env);
+
+void aot_unload (void);
+
+// NULL when the object has nothing for this offset
+aot_code aot_find (uint32_t offset);
+
+#endif /* _AOT_H_ */
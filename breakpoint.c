@@ -0,0 +1,334 @@
+#include "breakpoint.h"
+#include "cpu.h"
+
+#include <ctype.h>
+#include <strings.h>
+
+enum breakpoint_opcode {
+	BP_PUSH,   // value
+	BP_REG,    // value is a breakpoint_reg
+	BP_MEM,
+	BP_NOT,
+	BP_NEG,
+	BP_ADD,
+	BP_SUB,
+	BP_AND,
+	BP_OR,
+	BP_EQ,
+	BP_NE,
+	BP_LT,
+	BP_LE,
+	BP_GT,
+	BP_GE,
+	BP_LAND,
+	BP_LOR,
+};
+
+enum breakpoint_reg {
+	REG_A, REG_F, REG_B, REG_C, REG_D, REG_E, REG_H, REG_L,
+	REG_AF, REG_BC, REG_DE, REG_HL, REG_SP, REG_PC, REG_BANK,
+};
+
+typedef struct {
+	uint8_t opcode;
+	int32_t value;
+} breakpoint_op;
+
+typedef struct {
+	bool          used;
+	int           bank;
+	uint16_t      pc;
+	int           length; // 0 for no condition
+	breakpoint_op code[BREAKPOINT_CODE_SIZE];
+} breakpoint;
+
+// recursive descent over the condition text, emits postfix code
+typedef struct {
+	const char *text;
+	breakpoint *target;
+	bool       failed;
+} breakpoint_parser;
+
+static breakpoint         breakpoints[BREAKPOINT_MAX];
+static uint8_t            breakpoint_pcs[0x10000/8]; // pcs any breakpoint sits at
+static breakpoint_handler breakpoint_callback = NULL;
+static void               *breakpoint_user    = NULL;
+
+static const char *breakpoint_regs[] = {"a", "f", "b", "c", "d", "e", "h", "l", "af", "bc", "de", "hl", "sp", "pc", "bank"};
+
+static void breakpoint_emit (breakpoint_parser *parser, uint8_t opcode, int32_t value) {
+	if (parser->target->length == BREAKPOINT_CODE_SIZE) {
+		parser->failed = true;
+		return;
+	}
+	parser->target->code[parser->target->length++] = (breakpoint_op) {opcode, value};
+}
+
+static void breakpoint_skip (breakpoint_parser *parser) {
+	while (isspace((unsigned char) *parser->text)) {
+		parser->text++;
+	}
+}
+
+// takes token if it comes next, "&" doesn't take the first half of "&&"
+static bool breakpoint_take (breakpoint_parser *parser, const char *token) {
+	size_t length = strlen(token);
+
+	breakpoint_skip(parser);
+	if (strncmp(parser->text, token, length) != 0) {
+		return false;
+	}
+	if (length == 1 && (token[0] == '&' || token[0] == '|' || token[0] == '<' || token[0] == '>' || token[0] == '!')
+		&& (parser->text[1] == token[0] || parser->text[1] == '=')) {
+		return false;
+	}
+	parser->text += length;
+	return true;
+}
+
+static void breakpoint_parse_or (breakpoint_parser *parser);
+
+static void breakpoint_parse_primary (breakpoint_parser *parser) {
+	breakpoint_skip(parser);
+
+	if (breakpoint_take(parser, "(")) {
+		breakpoint_parse_or(parser);
+		parser->failed |= !breakpoint_take(parser, ")");
+	}
+	else if (breakpoint_take(parser, "[")) {
+		breakpoint_parse_or(parser);
+		parser->failed |= !breakpoint_take(parser, "]");
+		breakpoint_emit(parser, BP_MEM, 0);
+	}
+	else if (breakpoint_take(parser, "!")) {
+		breakpoint_parse_primary(parser);
+		breakpoint_emit(parser, BP_NOT, 0);
+	}
+	else if (breakpoint_take(parser, "-")) {
+		breakpoint_parse_primary(parser);
+		breakpoint_emit(parser, BP_NEG, 0);
+	}
+	else if (*parser->text == '$' || isdigit((unsigned char) *parser->text)) {
+		char *end   = NULL;
+		long value  = (*parser->text == '$') ? strtol(parser->text + 1, &end, 16) : strtol(parser->text, &end, 0);
+
+		parser->text = end;
+		breakpoint_emit(parser, BP_PUSH, value);
+	}
+	else if (isalpha((unsigned char) *parser->text)) {
+		size_t length = 0;
+
+		while (isalpha((unsigned char) parser->text[length])) {
+			length++;
+		}
+		for (size_t i = 0; i < sizeof(breakpoint_regs)/sizeof(breakpoint_regs[0]); ++i) {
+			if (strlen(breakpoint_regs[i]) == length && strncasecmp(parser->text, breakpoint_regs[i], length) == 0) {
+				parser->text += length;
+				breakpoint_emit(parser, BP_REG, i);
+				return;
+			}
+		}
+		parser->failed = true;
+	}
+	else {
+		parser->failed = true;
+	}
+}
+
+// binary operators from the loosest binding level up, C precedence
+static const struct {
+	const char *token;
+	uint8_t    opcode;
+	int        level;
+} breakpoint_operators[] = {
+	{"||", BP_LOR, 0},
+	{"&&", BP_LAND, 1},
+	{"|", BP_OR, 2},
+	{"&", BP_AND, 3},
+	{"==", BP_EQ, 4}, {"!=", BP_NE, 4},
+	{"<=", BP_LE, 5}, {">=", BP_GE, 5}, {"<", BP_LT, 5}, {">", BP_GT, 5},
+	{"+", BP_ADD, 6}, {"-", BP_SUB, 6},
+};
+
+#define BREAKPOINT_LEVELS 7
+
+static void breakpoint_parse_level (breakpoint_parser *parser, int level) {
+	bool taken = true;
+
+	if (level == BREAKPOINT_LEVELS) {
+		breakpoint_parse_primary(parser);
+		return;
+	}
+
+	breakpoint_parse_level(parser, level + 1);
+	while (taken && !parser->failed) {
+		taken = false;
+		for (size_t i = 0; i < sizeof(breakpoint_operators)/sizeof(breakpoint_operators[0]); ++i) {
+			if (breakpoint_operators[i].level == level && breakpoint_take(parser, breakpoint_operators[i].token)) {
+				breakpoint_parse_level(parser, level + 1);
+				breakpoint_emit(parser, breakpoint_operators[i].opcode, 0);
+				taken = true;
+				break;
+			}
+		}
+	}
+}
+
+static void breakpoint_parse_or (breakpoint_parser *parser) {
+	breakpoint_parse_level(parser, 0);
+}
+
+static int32_t breakpoint_reg (const breakpoint_state *state, int reg) {
+	switch (reg) {
+	case REG_A:    return state->af >> 8;
+	case REG_F:    return state->af & 0xFF;
+	case REG_B:    return state->bc >> 8;
+	case REG_C:    return state->bc & 0xFF;
+	case REG_D:    return state->de >> 8;
+	case REG_E:    return state->de & 0xFF;
+	case REG_H:    return state->hl >> 8;
+	case REG_L:    return state->hl & 0xFF;
+	case REG_AF:   return state->af;
+	case REG_BC:   return state->bc;
+	case REG_DE:   return state->de;
+	case REG_HL:   return state->hl;
+	case REG_SP:   return state->sp;
+	case REG_PC:   return state->pc;
+	default:       return (state->location & CPU_LOCATION_BUS) ? -1 : (int32_t) (state->location >> 14);
+	}
+}
+
+static bool breakpoint_eval (const breakpoint *bp, const breakpoint_state *state) {
+	int32_t stack[BREAKPOINT_CODE_SIZE];
+	int     depth = 0;
+
+	if (bp->length == 0) {
+		return true;
+	}
+
+	// the parser only emits well formed code, every operator finds its operands
+	for (int i = 0; i < bp->length; ++i) {
+		const breakpoint_op *op = &bp->code[i];
+		int32_t             a   = (depth >= 2) ? stack[depth - 2] : 0;
+		int32_t             b   = (depth >= 1) ? stack[depth - 1] : 0;
+
+		switch (op->opcode) {
+		case BP_PUSH: stack[depth++] = op->value; continue;
+		case BP_REG:  stack[depth++] = breakpoint_reg(state, op->value); continue;
+		case BP_MEM:  stack[depth - 1] = cpu_peek(b); continue;
+		case BP_NOT:  stack[depth - 1] = !b; continue;
+		case BP_NEG:  stack[depth - 1] = -b; continue;
+		case BP_ADD:  a = a + b; break;
+		case BP_SUB:  a = a - b; break;
+		case BP_AND:  a = a & b; break;
+		case BP_OR:   a = a | b; break;
+		case BP_EQ:   a = a == b; break;
+		case BP_NE:   a = a != b; break;
+		case BP_LT:   a = a < b; break;
+		case BP_LE:   a = a <= b; break;
+		case BP_GT:   a = a > b; break;
+		case BP_GE:   a = a >= b; break;
+		case BP_LAND: a = a && b; break;
+		case BP_LOR:  a = a || b; break;
+		}
+		stack[--depth - 1] = a;
+	}
+	return stack[0] != 0;
+}
+
+static void breakpoint_update (void) {
+	memset(breakpoint_pcs, 0x00, sizeof(breakpoint_pcs));
+	for (int i = 0; i < BREAKPOINT_MAX; ++i) {
+		if (breakpoints[i].used) {
+			breakpoint_pcs[breakpoints[i].pc >> 3] |= 1 << (breakpoints[i].pc & 0x7);
+		}
+	}
+	cpu_breakpoints_changed();
+}
+
+int breakpoint_add (int bank, uint16_t pc, const char *condition) {
+	for (int i = 0; i < BREAKPOINT_MAX; ++i) {
+		if (breakpoints[i].used) {
+			continue;
+		}
+
+		breakpoint_parser parser = {condition, &breakpoints[i], false};
+
+		breakpoints[i].bank   = bank;
+		breakpoints[i].pc     = pc;
+		breakpoints[i].length = 0;
+		if (condition != NULL) {
+			breakpoint_parse_or(&parser);
+			breakpoint_skip(&parser);
+			if (parser.failed || *parser.text != '\0') {
+				println("Can't compile condition \'%s\'", condition);
+				return -1;
+			}
+		}
+		breakpoints[i].used = true;
+		breakpoint_update();
+		return i;
+	}
+	println("No breakpoints left");
+	return -1;
+}
+
+void breakpoint_remove (int id) {
+	if (id >= 0 && id < BREAKPOINT_MAX && breakpoints[id].used) {
+		breakpoints[id].used = false;
+		breakpoint_update();
+	}
+}
+
+void breakpoint_set_handler (breakpoint_handler handler, void *user) {
+	breakpoint_callback = handler;
+	breakpoint_user     = user;
+}
+
+bool breakpoint_at (uint16_t pc) {
+	return breakpoint_pcs[pc >> 3] & (1 << (pc & 0x7));
+}
+
+bool breakpoint_any (void) {
+	for (int i = 0; i < BREAKPOINT_MAX; ++i) {
+		if (breakpoints[i].used) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool breakpoint_pause (int id, const breakpoint_state *state, void *user) {
+	char line[64] = "";
+
+	if (state->location & CPU_LOCATION_BUS) {
+		println("breakpoint %d at 0x%04x", id, state->pc);
+	}
+	else {
+		println("breakpoint %d at %02x:0x%04x", id, state->location >> 14, state->pc);
+	}
+	println(" AF:0x%04x BC:0x%04x DE:0x%04x HL:0x%04x SP:0x%04x", state->af, state->bc, state->de, state->hl, state->sp);
+	println("enter continues, d enter removes the breakpoint");
+	if (fgets(line, sizeof(line), stdin) == NULL) {
+		return true;
+	}
+	return line[0] != 'd';
+}
+
+void breakpoint_hit (const breakpoint_state *state) {
+	int bank = breakpoint_reg(state, REG_BANK);
+
+	for (int i = 0; i < BREAKPOINT_MAX; ++i) {
+		const breakpoint *bp = &breakpoints[i];
+
+		if (!bp->used || bp->pc != state->pc || (bp->bank >= 0 && bp->bank != bank) || !breakpoint_eval(bp, state)) {
+			continue;
+		}
+
+		bool keep = (breakpoint_callback != NULL) ? breakpoint_callback(i, state, breakpoint_user)
+		                                          : breakpoint_pause(i, state, NULL);
+		if (!keep) {
+			breakpoint_remove(i);
+		}
+	}
+}
@@ -0,0 +1,47 @@
+#ifndef _BREAKPOINT_H_
+#define _BREAKPOINT_H_
+
+#include "common.h"
+
+/*
+ * PC breakpoints with conditions. A condition is compiled once into a small
+ * stack bytecode, cpu.c swaps the handler of the decoded ops at breakpoint
+ * addresses for one that evaluates it, so nothing else pays for them.
+ * Conditions are C like expressions over a f b c d e h l af bc de hl sp pc
+ * bank, numbers (0x3F, $3F or decimal) and [addr] for a memory byte, e.g.
+ * "a == 0x3F && bank == 5".
+ */
+#define BREAKPOINT_MAX       32
+#define BREAKPOINT_CODE_SIZE 64 // bytecode ops per condition
+
+// registers before the instruction at pc runs
+typedef struct {
+	uint16_t af;
+	uint16_t bc;
+	uint16_t de;
+	uint16_t hl;
+	uint16_t sp;
+	uint16_t pc;
+	uint32_t location; // cpu_location of pc
+} breakpoint_state;
+
+// runs with the cpu paused in front of the instruction, returns false to remove the breakpoint
+typedef bool (*breakpoint_handler) (int id, const breakpoint_state *state, void *user);
+
+// bank -1 matches every bank, condition NULL always holds, returns the id or -1 when it doesn't compile or all are taken
+int breakpoint_add (int bank, uint16_t pc, const char *condition);
+
+void breakpoint_remove (int id);
+
+// NULL prints the registers and waits for a line on stdin, "d" removes the breakpoint
+void breakpoint_set_handler (breakpoint_handler handler, void *user);
+
+// whether ops at pc need the trap handler, in whatever bank
+bool breakpoint_at (uint16_t pc);
+
+bool breakpoint_any (void);
+
+// checks the breakpoints at state->pc and calls the handler for those whose condition holds
+void breakpoint_hit (const breakpoint_state *state);
+
+#endif /* _BREAKPOINT_H_ */
@@ -1,15 +1,41 @@
 #include "common.h"
 #include <stdarg.h>
+#include <sys/stat.h>
 #include "joypad.h"
+#include "probes.h"
 #include "rom.h"
 
+#if !defined(__EMSCRIPTEN__) && !defined(_WIN32)
+#define ROM_USE_MMAP
+#include <sys/mman.h>
+#endif
+
+#define ROM_CACHE_SIZE   16
+#define ROM_HEADER_END   0x0150
+#define ROM_MIN_SIZE     0x8000 // bank 0 and 1
+
 typedef void (*key_handler) (int key);
 
-static FILE         *log_file        = NULL;
-static SDL_Window   *window          = NULL;
-static SDL_Renderer *renderer        = NULL;
-static key_handler  key_up_handler   = NULL;
-static key_handler  key_down_handler = NULL;
+// rom images are read only, so every instance loading the same file shares one copy
+typedef struct {
+	char     *path;
+	dev_t    device;
+	ino_t    inode;
+	time_t   modified;
+	uint8_t  *data;
+	size_t   size;     // file size, or ROM_MIN_SIZE for a padded copy of a shorter file
+	bool     mapped;
+	int      refs;
+} rom_image;
+
+static FILE              *log_file        = NULL;
+static SDL_Window        *window          = NULL;
+static SDL_Renderer      *renderer        = NULL;
+static key_handler       key_up_handler   = NULL;
+static key_handler       key_down_handler = NULL;
+static SDL_AudioDeviceID audio_device     = 0;
+static rom_image         rom_cache[ROM_CACHE_SIZE];
+static rom_image         *loaded_rom      = NULL;
 
 void common_init (void) {
 	log_file = stdout;
@@ -26,39 +52,145 @@ void common_init (void) {
 	SDL_RenderSetScale(renderer, (float) RENDER_SCALE, (float) RENDER_SCALE);
 }
 
-void file_load_rom (const char *rom_filename) {
-	FILE *rom    = fopen(rom_filename, "rb");
-	long romsize = 0;
+// finds a cached image of the same file, or maps a new one
+static rom_image *rom_cache_acquire (const char *rom_filename) {
+	struct stat info;
+	long        length = 0;
+	size_t      size   = 0;
+	size_t      padded = 0;
+	uint8_t     *data  = NULL;
+	bool        mapped = false;
+	FILE        *rom   = fopen(rom_filename, "rb");
+
 	if (rom == NULL) {
 		println("Failed to open rom file \'%s\'", rom_filename);
-		return;
+		return NULL;
 	}
 
 	fseek(rom, 0, SEEK_END);
-	romsize = ftell(rom);
+	length = ftell(rom);
 	fseek(rom, 0, SEEK_SET);  /* same as rewind(f); */
 
-	uint8_t *romdata = (void *) malloc(romsize*sizeof(uint8_t));
+	if (length < 0 || fstat(fileno(rom), &info) != 0) {
+		println("Failed to get the size of rom file \'%s\'", rom_filename);
+		fclose(rom);
+		return NULL;
+	}
+	size = length;
+	if (size < ROM_HEADER_END) {
+		println("Rom file \'%s\' is too small", rom_filename);
+		fclose(rom);
+		return NULL;
+	}
+	// mappers read all of bank 0 and 1, a shorter file gets a copy padded with zeros
+	padded = (size < ROM_MIN_SIZE) ? ROM_MIN_SIZE : size;
 
-	size_t read_res = fread(romdata, 0x1, romsize, rom);
-	if (read_res != romsize) {
-		println("Wtf? Can't read full file");
-		return;
+	// the same file, unless it was replaced or rewritten since it got cached
+	for (int i = 0; i < ROM_CACHE_SIZE; ++i) {
+		if (rom_cache[i].refs > 0 && rom_cache[i].device == info.st_dev && rom_cache[i].inode == info.st_ino
+			&& rom_cache[i].size == padded && rom_cache[i].modified == info.st_mtime) {
+			fclose(rom);
+			rom_cache[i].refs++;
+			return &rom_cache[i];
+		}
+	}
+
+#ifdef ROM_USE_MMAP
+	// pages are shared with every other mapping of the file and faulted in on first access
+	if (padded == size) {
+		data = mmap(NULL, size, PROT_READ, MAP_SHARED, fileno(rom), 0);
+		if (data == MAP_FAILED) {
+			println("Failed to map rom file \'%s\'", rom_filename);
+			fclose(rom);
+			return NULL;
+		}
+		mapped = true;
+	}
+#endif
+	if (!mapped) {
+		data = calloc(padded, sizeof(uint8_t));
+		if (data == NULL || fread(data, 0x1, size, rom) != size) {
+			println("Wtf? Can't read full file");
+			free(data);
+			fclose(rom);
+			return NULL;
+		}
+		if (padded != size) {
+			println("Rom file is only 0x%zx bytes, padded to 0x%zx", size, padded);
+		}
+		size = padded;
 	}
 	fclose(rom);
 
-	if (romdata[0x0147] != 0x00 && romdata[0x0147] != 0x01 && romdata[0x0147] != 0x02 && romdata[0x0147] != 0x03) {
+	for (int i = 0; i < ROM_CACHE_SIZE; ++i) {
+		if (rom_cache[i].refs == 0) {
+			rom_cache[i].path     = strdup(rom_filename);
+			rom_cache[i].device   = info.st_dev;
+			rom_cache[i].inode    = info.st_ino;
+			rom_cache[i].modified = info.st_mtime;
+			rom_cache[i].data     = data;
+			rom_cache[i].size     = size;
+			rom_cache[i].mapped   = mapped;
+			rom_cache[i].refs     = 1;
+			return &rom_cache[i];
+		}
+	}
+
+	println("Rom cache is full");
+#ifdef ROM_USE_MMAP
+	if (mapped) {
+		munmap(data, size);
+	}
+#endif
+	if (!mapped) {
+		free(data);
+	}
+	return NULL;
+}
+
+static void rom_cache_release (rom_image *image) {
+	if (image == NULL || --image->refs > 0) {
+		return;
+	}
+
+#ifdef ROM_USE_MMAP
+	if (image->mapped) {
+		munmap(image->data, image->size);
+	}
+#endif
+	if (!image->mapped) {
+		free(image->data);
+	}
+	free(image->path);
+	memset(image, 0x00, sizeof(rom_image));
+}
+
+void file_load_rom (const char *rom_filename) {
+	rom_image *image = rom_cache_acquire(rom_filename);
+	if (image == NULL) {
+		return;
+	}
+
+	uint8_t *romdata = image->data;
+	size_t  romsize  = image->size;
+
+	if (!rom_is_supported(romdata[0x0147])) {
 		println("Mapper is not supported, mapper version is %02x", romdata[0x0147]);
+		rom_cache_release(image);
 		return;
 	}
 	else {
-		println("Actual filesize is 0x%x", romsize);
+		println("Actual filesize is 0x%zx", romsize);
 		println("Mapper is %02x", romdata[0x0147]);
 		println("ROM size is %02x", romdata[0x0148]);
 		println("RAM size is %02x", romdata[0x0149]);
 	}
 
-	rom_load(romdata, romsize, romdata[0x0147]);
+	rom_load(rom_filename, romdata, romsize, romdata[0x0147]);
+	PROBE2(rom_load, rom_filename, romsize);
+
+	rom_cache_release(loaded_rom);
+	loaded_rom = image;
 }
 
 void screen_put_pixel (int x, int y, uint8_t r, uint8_t g, uint8_t b) {
@@ -75,6 +207,39 @@ void screen_clear (void) {
 	SDL_RenderClear(renderer);
 }
 
+bool audio_init (void) {
+	SDL_AudioSpec want = {0};
+	SDL_AudioSpec have = {0};
+
+	if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+		println("Failed to init audio: %s", SDL_GetError());
+		return false;
+	}
+
+	want.freq     = AUDIO_SAMPLE_RATE;
+	want.format   = AUDIO_S16SYS;
+	want.channels = 1;
+	want.samples  = 512;
+	want.callback = NULL; // queue mode, we push samples from the emulation loop
+
+	audio_device = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+	if (audio_device == 0) {
+		println("Failed to open audio device: %s", SDL_GetError());
+		return false;
+	}
+
+	SDL_PauseAudioDevice(audio_device, 0);
+	return true;
+}
+
+void audio_push_samples (const int16_t *samples, int count) {
+	SDL_QueueAudio(audio_device, samples, count*sizeof(int16_t));
+}
+
+int audio_queued_samples (void) {
+	return SDL_GetQueuedAudioSize(audio_device)/sizeof(int16_t);
+}
+
 void keyboard_set_handlers (void (*key_down) (int key), void (*key_up) (int key)) {
 	key_up_handler   = key_up;
 	key_down_handler = key_down;
@@ -120,6 +285,13 @@ void keyboard_handle_input (SDL_Event *event) {
 }
 
 void common_shutdown (void) {
+	rom_unload();
+	rom_cache_release(loaded_rom);
+	loaded_rom = NULL;
+
+	if (audio_device != 0) {
+		SDL_CloseAudioDevice(audio_device);
+	}
 	SDL_DestroyWindow(window);
 	SDL_Quit();
 }
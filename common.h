@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -18,6 +19,12 @@
 /* switch to enable GPU debug window and debug output*/
 #undef DEBUG_BUILD
 
+/* switch to count executed opcodes, their cycles and opcode pairs, cpu_profile_report prints them */
+#undef OPCODE_PROFILER
+
+/* switch to also count how often each rom instruction ran while recording coverage, see coverage.h */
+#undef COVERAGE_COUNTS
+
 #define ALWAYS_INLINE __attribute__((always_inline))
 
 #define SCREEN_WIDTH  160
@@ -27,10 +34,18 @@
 #define RENDER_WIDTH (SCREEN_WIDTH * RENDER_SCALE)
 #define RENDER_HEIGHT (SCREEN_HEIGHT * RENDER_SCALE)
 
+/* DMG master clock and one full frame: 154 lines by 456 cycles, ~59.73 Hz */
+#define CPU_CLOCK_HZ 4194304
+#define FRAME_CYCLES 70224
+
+#define AUDIO_SAMPLE_RATE 48000
+
 typedef struct rom_mapper_func {
-	void (*init)(uint8_t *rom, uint64_t filesize);
+	void (*init)(uint8_t *rom, uint64_t filesize, uint8_t *ram, uint32_t ram_size);
 	uint8_t (*read)(uint16_t address);
 	void (*write)(uint16_t address, uint8_t val);
+	// direct pointer into the currently mapped rom, only valid for 0x0000-0x7FFF
+	const uint8_t *(*ptr)(uint16_t address);
 } rom_mapper_func_t;
 
 void common_init ();
@@ -49,6 +64,12 @@ void screen_vsync (void);
 
 void screen_put_pixel (int x, int y, uint8_t r, uint8_t g, uint8_t b);
 
+bool audio_init (void);
+
+void audio_push_samples (const int16_t *samples, int count);
+
+int audio_queued_samples (void);
+
 void keyboard_set_handlers (void (*key_down) (int key), void (*key_up) (int key));
 
 void keyboard_handle_input (SDL_Event *event);
@@ -0,0 +1,75 @@
+#include "common.h"
+#include "coverage.h"
+
+// until coverage_start everything lands in the sinks
+static uint8_t  coverage_sink[COVERAGE_SINK];
+static uint32_t coverage_hit_sink[COVERAGE_SINK*8];
+static uint8_t  *coverage_map     = coverage_sink;
+static uint32_t *coverage_hits    = coverage_hit_sink;
+static bool     coverage_counting = false;
+static uint32_t coverage_size     = 0;
+static uint16_t coverage_checksum = 0;
+
+bool coverage_start (const uint8_t *rom, uint32_t rom_size) {
+	if (coverage_map != coverage_sink) {
+		free(coverage_map);
+	}
+	if (coverage_hits != coverage_hit_sink) {
+		free(coverage_hits);
+	}
+	coverage_map      = coverage_sink;
+	coverage_hits     = coverage_hit_sink;
+	coverage_counting = false;
+	coverage_size     = 0;
+
+	if (rom_size == 0) {
+		println("Unknown rom size, no coverage");
+		return false;
+	}
+
+	coverage_map = calloc(rom_size/8 + COVERAGE_SINK, sizeof(uint8_t));
+#ifdef COVERAGE_COUNTS
+	coverage_hits     = calloc(rom_size + COVERAGE_SINK*8, sizeof(uint32_t));
+	coverage_counting = true;
+#endif
+	coverage_size     = rom_size;
+	coverage_checksum = (rom[0x14E] << 8) | rom[0x14F];
+	return true;
+}
+
+uint8_t *coverage_bits (void) {
+	return coverage_map;
+}
+
+uint32_t *coverage_counts (void) {
+	return coverage_hits;
+}
+
+bool coverage_write (const char *path) {
+	coverage_header header  = {COVERAGE_MAGIC, COVERAGE_VERSION, coverage_size, coverage_checksum, coverage_counting};
+	uint32_t        covered = 0;
+
+	if (coverage_size == 0) {
+		return false;
+	}
+
+	FILE *out = fopen(path, "wb");
+	if (out == NULL) {
+		println("Failed to open \'%s\'", path);
+		return false;
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, out) == 1
+	          && fwrite(coverage_map, coverage_size/8, 1, out) == 1
+	          && (!coverage_counting || fwrite(coverage_hits, sizeof(uint32_t), coverage_size, out) == coverage_size);
+	fclose(out);
+	if (!ok) {
+		println("Failed to write \'%s\'", path);
+		return false;
+	}
+
+	for (uint32_t i = 0; i < coverage_size/8; ++i) {
+		covered += __builtin_popcount(coverage_map[i]);
+	}
+	println("Covered %u of %u rom bytes (%.2f%%), wrote \'%s\'", covered, coverage_size, 100.0*covered/coverage_size, path);
+	return true;
+}
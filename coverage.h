@@ -0,0 +1,40 @@
+#ifndef _COVERAGE_H_
+#define _COVERAGE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * ROM code coverage. The map has one bit per rom byte, bit n%8 of byte n/8
+ * is set once an executed instruction covered rom byte n. cpu.c marks
+ * instructions with one 16 bit OR, code outside the rom lands in a sink
+ * after the rom bits. Built with COVERAGE_COUNTS there is also a counter
+ * per rom byte an instruction started at. tools/coverage.c merges files
+ * of many runs and prints the per bank report, it shares only this header.
+ */
+#define COVERAGE_MAGIC   "GBCOVER" // 8 bytes with the terminator
+#define COVERAGE_VERSION 1
+#define COVERAGE_SINK    64 // bytes after the rom bits, enough for the widest block of ops
+
+// file header, the bitmap follows and then the counters if there are any, all in host byte order
+typedef struct {
+	char     magic[8];
+	uint32_t version;
+	uint32_t rom_size;     // bytes, from the rom header, the bitmap has rom_size/8 bytes
+	uint16_t rom_checksum; // header bytes 0x14E-0x14F, big endian
+	uint8_t  counts;       // a uint32_t per rom byte follows the bitmap
+	uint8_t  unused[5];
+} coverage_header;
+
+// allocates empty maps for the rom, the sinks start at bit and counter rom_size
+bool coverage_start (const uint8_t *rom, uint32_t rom_size);
+
+// only sinks until coverage_start, so marking never has to check
+uint8_t *coverage_bits (void);
+
+uint32_t *coverage_counts (void);
+
+// writes the maps and prints how much of the rom was covered
+bool coverage_write (const char *path);
+
+#endif /* _COVERAGE_H_ */
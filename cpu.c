@@ -1,9 +1,18 @@
 #include "common.h"
 #include "cpu.h"
+#include "cpu_state.h"
 #include "gpu.h"
-#include "joypad.h"
+#include "io.h"
+#include "aot.h"
+#include "breakpoint.h"
+#include "coverage.h"
+#include "jit.h"
+#include "probes.h"
+#include "profiler.h"
 #include "rom.h"
-#include "timer.h"
+#include "stats.h"
+#include "trace.h"
+#include "watch.h"
 
 enum flags {
 	C = 4,
@@ -12,43 +21,60 @@ enum flags {
 	Z = 7
 };
 
-enum registers {
-	REG_B = 0,
-	REG_C,
-	REG_D,
-	REG_E,
-	REG_H,
-	REG_L,
-	REG_HL,
-	REG_A
+/*
+ * Lazy flags: 8 bit ALU ops only record what they did, cpu.f is computed
+ * when something needs N or H (or the whole byte). Z and C come straight
+ * from the recorded result, it keeps bit 8 as carry out for every op.
+ */
+enum flags_op {
+	FLAGS_NONE = 0, // cpu.f is up to date
+	FLAGS_ADD,      // ADD, ADC
+	FLAGS_SUB,      // SUB, SBC, CP
+	FLAGS_AND,
+	FLAGS_OR,       // OR, XOR
+	FLAGS_INC,      // bit 8 of the result holds the untouched carry
+	FLAGS_DEC
 };
 
 // I assume that cpu_state is `cpu` object
-#define GET_FLAG(flag)   ((cpu.f >> (flag)) & 0x1)
+#define GET_FLAG(flag)   (cpu.flags_op == FLAGS_NONE ? (cpu.f >> (flag)) & 0x1 : cpu_lazy_flag(flag))
+
+// operand bytes of the running instruction, cpu.pc already points past them
+#define IMM8  ((uint8_t) cpu.imm)
+#define IMM16 (cpu.imm)
 
 #define SET_FLAGS(zflag, nflag, hflag, cflag) \
                     ((!!(zflag) << Z) | (!!(nflag) << N) | (!!(hflag) << H) | (!!(cflag) << C) | 0)
 
-// TODO: fixme: H flag set
-#define SET_INC_FLAGS(data) (cpu.f = SET_FLAGS(data == 0, 0, ((data & 0x0F) == 0x00), GET_FLAG(C)))
-#define SET_DEC_FLAGS(data) (cpu.f = SET_FLAGS(data == 0, 1, ((data & 0x0F) == 0x0F), GET_FLAG(C)))
-#define SET_AND_FLAGS() (cpu.f = SET_FLAGS(cpu.a == 0, 0, 1, 0))
-#define SET_xOR_FLAGS() (cpu.f = SET_FLAGS(cpu.a == 0, 0, 0, 0))
+#define SET_INC_FLAGS(data) cpu_lazy_flags(FLAGS_INC, 0, 0, (data) | (GET_FLAG(C) << 8))
+#define SET_DEC_FLAGS(data) cpu_lazy_flags(FLAGS_DEC, 0, 0, (data) | (GET_FLAG(C) << 8))
+#define SET_AND_FLAGS() cpu_lazy_flags(FLAGS_AND, 0, 0, cpu.a)
+#define SET_xOR_FLAGS() cpu_lazy_flags(FLAGS_OR, 0, 0, cpu.a)
 
 // bit ops flags
-#define SET_BIT_FLAGS(bit, reg) (cpu.f = SET_FLAGS(!(reg & (0x1 << bit)), 0, 1, GET_FLAG(C)))
-#define SET_SWAP_FLAGS(data) (cpu.f = SET_FLAGS(data == 0, 0, 0, 0))
+#define SET_BIT_FLAGS(bit, reg) cpu_set_flags(!(reg & (0x1 << bit)), 0, 1, GET_FLAG(C))
+#define SET_SWAP_FLAGS(data) cpu_set_flags(data == 0, 0, 0, 0)
 
 
 static void cpu_dump_state ();
 
 static int cpu_step_real (void);
 
+static inline void cpu_set_flags (bool z, bool n, bool h, bool c);
+
+static inline void cpu_lazy_flags (enum flags_op op, uint8_t a, uint8_t b, uint16_t res);
+
+static inline uint8_t cpu_lazy_flag (enum flags flag);
+
+static inline void cpu_flags_sync (void);
+
 static void handle_interrupts (void);
 
-static uint8_t cpu_read_register (uint16_t addr);
+static inline void cpu_update_interrupts (void);
+
+static void cpu_write_interrupt_flag (uint16_t addr, uint8_t val);
 
-static void cpu_write_register (uint16_t addr, uint8_t val);
+static inline ALWAYS_INLINE uint8_t read_byte_bus (uint16_t addr);
 
 static inline ALWAYS_INLINE uint8_t read_byte (uint16_t addr);
 
@@ -62,42 +88,32 @@ static inline ALWAYS_INLINE void stack_push (uint16_t val);
 
 static inline ALWAYS_INLINE uint16_t stack_pop (void);
 
-static uint8_t serial_read (void);
+static uint8_t cpu_read_boot_rom_reg (uint16_t addr);
 
-static void serial_write (uint8_t data);
+static void cpu_write_boot_rom_reg (uint16_t addr, uint8_t val);
 
-static void serial_write_control (uint8_t data);
+static void cpu_restore_boot_rom_reg (uint16_t addr, uint8_t val);
 
-static enum registers map_register (uint8_t opcode);
+static void serial_write_control (uint16_t addr, uint8_t data);
 
 static void cpu_print_mem (uint16_t begin, uint16_t end);
 
-static void cpu_opcode_bit (enum registers reg, uint8_t bit);
+static inline void cpu_opcode_bit (uint8_t value, uint8_t bit);
 
-static inline void cpu_opcode_set (enum registers reg, uint8_t bit);
+static inline uint8_t cpu_opcode_set (uint8_t value, uint8_t bit);
 
-static inline void cpu_opcode_res (enum registers reg, uint8_t bit);
+static inline uint8_t cpu_opcode_res (uint8_t value, uint8_t bit);
 
-static inline void cpu_opcode_swap(enum registers reg);
+static inline uint8_t cpu_opcode_swap (uint8_t value);
 
 static inline uint8_t cpu_opcode_rl(uint8_t data);
 
 static inline void cpu_opcode_rla ();
 
-static inline void cpu_opcode_rl_full (enum registers reg);
-
 static inline uint8_t cpu_opcode_rr (uint8_t data);
 
 static inline void cpu_opcode_rra ();
 
-static inline void cpu_opcode_rr_full (enum registers reg);
-
-static inline void cpu_opcode_sla_full (enum registers reg);
-
-static inline void cpu_opcode_srl_full (enum registers reg);
-
-static inline void cpu_opcode_sra_full (enum registers reg);
-
 static inline uint8_t cpu_opcode_rlc (uint8_t value);
 
 static inline uint8_t cpu_opcode_rrc (uint8_t value);
@@ -112,10 +128,6 @@ static inline void cpu_opcode_rlca ();
 
 static inline void cpu_opcode_rrca ();
 
-static inline void cpu_opcode_rlc_full (enum registers reg);
-
-static inline void cpu_opcode_rrc_full (enum registers reg);
-
 static void cpu_prefix_cb_handle (int *cycles);
 
 static inline void cpu_opcode_daa();
@@ -423,56 +435,6 @@ static void cpu_instr_0xfd(int *cycles);
 static void cpu_instr_0xfe(int *cycles);
 static void cpu_instr_0xff(int *cycles);
 
-typedef struct {
-	struct {
-		union {
-			struct {
-				uint8_t f;
-				uint8_t a;
-			};
-			uint16_t af;
-		};
-	};
-	struct {
-		union {
-			struct {
-				uint8_t c;
-				uint8_t b;
-			};
-			uint16_t bc;
-		};
-	};
-	struct {
-		union {
-			struct {
-				uint8_t e;
-				uint8_t d;
-			};
-			uint16_t de;
-		};
-	};
-	struct {
-		union {
-			struct {
-				uint8_t l;
-				uint8_t h;
-			};
-			uint16_t hl;
-		};
-	};
-	uint16_t sp;
-	uint16_t pc;
-
-	bool stop;
-
-	bool boot_rom_enabled;
-
-	bool ime;
-
-	uint8_t interrupt_flag;
-
-	uint8_t interrupt_enable;
-} cpu_state;
 
 // this is a table for cycles count for each instruction
 // we might modify cycles counter in cpu_step()
@@ -514,6 +476,26 @@ static int cycles_0xCB_opcodes[256] = {
 	8, 8, 8, 8, 8, 8, 16, 8, 8, 8, 8, 8, 8, 8, 16, 8
 };
 
+// opcode plus operand bytes
+static const uint8_t instruction_length[256] = {
+	1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1,
+	1, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+	2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+	2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1,
+	1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1,
+	2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1,
+	2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1
+};
+
 typedef void (*instruction_handler)(int *cycles);
 
 static instruction_handler instructions[256] = {
@@ -574,9 +556,71 @@ static instruction_handler instructions[256] = {
 // CPU STATE
 static cpu_state cpu;
 
+static inline void cpu_set_flags (bool z, bool n, bool h, bool c) {
+	cpu.f        = SET_FLAGS(z, n, h, c);
+	cpu.flags_op = FLAGS_NONE;
+}
+
+static inline void cpu_lazy_flags (enum flags_op op, uint8_t a, uint8_t b, uint16_t res) {
+	cpu.flags_op  = op;
+	cpu.flags_a   = a;
+	cpu.flags_b   = b;
+	cpu.flags_res = res;
+}
+
+// writes the pending op into cpu.f, needed before anyone looks at F as a byte
+static inline void cpu_flags_sync (void) {
+	if (cpu.flags_op == FLAGS_NONE) {
+		return;
+	}
+
+	bool    z    = (cpu.flags_res & 0xFF) == 0;
+	bool    c    = (cpu.flags_res & 0x100) != 0;
+	uint8_t half = (cpu.flags_a ^ cpu.flags_b ^ cpu.flags_res) & 0x10;
+
+	switch (cpu.flags_op) {
+	case FLAGS_ADD:
+		cpu_set_flags(z, 0, half, c);
+		break;
+	case FLAGS_SUB:
+		cpu_set_flags(z, 1, half, c);
+		break;
+	case FLAGS_AND:
+		cpu_set_flags(z, 0, 1, 0);
+		break;
+	case FLAGS_OR:
+		cpu_set_flags(z, 0, 0, 0);
+		break;
+	case FLAGS_INC:
+		cpu_set_flags(z, 0, (cpu.flags_res & 0x0F) == 0x00, c);
+		break;
+	case FLAGS_DEC:
+		cpu_set_flags(z, 1, (cpu.flags_res & 0x0F) == 0x0F, c);
+		break;
+	default:
+		break;
+	}
+}
+
+static inline uint8_t cpu_lazy_flag (enum flags flag) {
+	switch (flag) {
+	case Z:
+		return (cpu.flags_res & 0xFF) == 0;
+	case C:
+		return (cpu.flags_res >> 8) & 0x1;
+	default:
+		cpu_flags_sync();
+		return (cpu.f >> flag) & 0x1;
+	}
+}
+
 // ALL KINDS OF MEMORY
 static uint8_t iram[0x4000]; // internal ram, 8kbytes
 static uint8_t zeropage[0x7F]; // high mem
+
+// read_byte and write_byte leave their fast path while the bus is locked or a watchpoint is set
+static bool bus_trapped = false;
+static bool bus_watched = false;
 // 0x0000 -> 0x3FFF - ROM bank #0
 // 0x4000 -> 0x7FFF - ROM bank #n, we map to 1 bank just for no mapper roms setup
 // 0x8000 -> 0x9FFF - Video RAM
@@ -585,10 +629,12 @@ static uint8_t zeropage[0x7F]; // high mem
 // 0xE000 -> 0xFDFF - mirroring of 0xC000 region
 // 0xFE00 -> 0xFE9F - OAM
 // 0xFEA0 -> 0xFEFF - unusable memory area
-// 0xFF00 -> 0xFF7F - registers, handled via two functions
+// 0xFF00 -> 0xFF7F - registers, dispatched through io.c table
 // 0xFF80 -> 0xFFFE - high RAM or zeropage
 // 0xFFFF -> 0xFFFF - interrupt register
 
+static uint8_t serial_data = 0x0;
+
 static uint8_t boot_rom[256] = {
 	0x31, 0xfe, 0xff, 0xaf, 0x21, 0xff, 0x9f, 0x32, 0xcb, 0x7c, 0x20, 0xfb,
 	0x21, 0x26, 0xff, 0x0e, 0x11, 0x3e, 0x80, 0x32, 0xe2, 0x0c, 0x3e, 0xf3,
@@ -614,91 +660,1459 @@ static uint8_t boot_rom[256] = {
 	0x3e, 0x01, 0xe0, 0x50
 };
 
+/*
+ * Decoded block cache. Code running from ROM, WRAM or HRAM is decoded
+ * once into micro-ops with operands already resolved, cpu_step then
+ * walks the block one op per call, so gpu and timer keep per instruction
+ * timing. Blocks are keyed by the host address of their first opcode,
+ * which tells ROM banks apart. Bank switches only drop the running block,
+ * writes to RAM bytes that belong to a cached block drop all RAM blocks.
+ * VRAM, cartridge RAM and anything else is decoded through the bus.
+ *
+ * With the recompiler on, ROM blocks that keep getting entered are also
+ * translated to host code which runs the whole block in one cpu_step.
+ * With a fusion profile loaded, short hot opcode sequences in ROM blocks
+ * are merged into one op, see fuse_candidates.
+ */
+#define BLOCK_MAX_OPS    32
+#define BLOCK_CACHE_SIZE 4096 // direct mapped, power of two
+#define BLOCK_JIT_HITS   16   // lookups before a ROM block gets translated
+
+typedef struct {
+	instruction_handler handler;
+	uint16_t            pc;     // address of the opcode
+	uint16_t            imm;    // operand bytes, little endian
+	uint8_t             len;
+	uint8_t             cycles; // base cycles, taken branches add the rest
+	uint8_t             opcode;
+	uint8_t             imm2;   // third operand byte of fused ops
+	uint8_t             instructions; // guest instructions it stands for, fused ops cover several
+} micro_op;
+
+typedef struct {
+	const uint8_t *code;   // host address of the first opcode
+	uint16_t      pc;
+	uint8_t       count;
+	bool          in_ram;
+	bool          breaks;  // some ops run cpu_instr_break, never translated or fused
+	uint8_t       hits;
+	int           cycles;  // straight line cost of all ops
+	jit_code      native;  // translated block, NULL until it gets hot
+	uint32_t      coverage; // bit of the first opcode in coverage_map
+	micro_op      ops[BLOCK_MAX_OPS];
+} code_block;
+
+static code_block block_cache[BLOCK_CACHE_SIZE];
+static code_block *block_current = NULL;
+static int        block_next_op  = 0;
+#ifdef JIT_AVAILABLE
+static bool       block_jit      = false;
+#endif
+
+// one bit per rom byte a block started at while recording for cpu_aot_generate
+static uint8_t *aot_seen = NULL;
+
+// what a loaded object sees, kept here so recording coverage later can still reach it
+static aot_env aot_bound;
+
+// coverage_base + pc is the bit of pc in coverage_map, code outside the rom is pointed at the sink
+static uint8_t  *coverage_map     = NULL;
+static uint32_t *coverage_hits    = NULL;
+static uint32_t coverage_base     = 0;
+static uint32_t coverage_rom_size = 0; // where the sink starts, 0 while not recording
+
+// one flag per WRAM/HRAM byte that some cached block was decoded from
+static bool iram_code[0x4000];
+static bool zeropage_code[0x7F];
+
+static const instruction_handler cb_instructions[256];
+
+static void cpu_instr_break (int *cycles);
+
+// set while any breakpoint exists, blocks then check their ops against breakpoint_at when decoded
+static bool break_active = false;
+
+/*
+ * Superinstructions: sequences that are known to be hot in real games get
+ * one handler that does all of them, without a dispatch in between and
+ * branching on the result instead of the flags. They are only used once a
+ * profile written by cpu_fuse_write names them, since a fused op is one
+ * step for gpu, timer and interrupts.
+ */
+#define FUSE_CANDIDATES 9
+#define FUSE_MAX_OPS    3
+#define FUSE_MIN_SHARE  1000 // profile enables sequences above 1/1000 of all executed ops
+
+typedef struct {
+	const char          *name;
+	int                 count;  // opcodes in the sequence
+	uint8_t             opcodes[FUSE_MAX_OPS];
+	instruction_handler handler;
+} fuse_candidate;
+
+static const fuse_candidate fuse_candidates[FUSE_CANDIDATES];
+
+static bool     fuse_enabled[FUSE_CANDIDATES];
+static bool     fuse_active      = false;
+static bool     fuse_recording   = false;
+static uint64_t fuse_counts[FUSE_CANDIDATES];
+static uint64_t fuse_total       = 0;
+static uint32_t fuse_history     = 0; // opcodes that ran back to back, newest in the low byte
+static int      fuse_history_len = 0;
+static uint16_t fuse_next_pc     = 0;
+
+static void cpu_decode (micro_op *op, uint16_t pc, const uint8_t *code) {
+	uint8_t opcode = code[0];
+
+	op->pc      = pc;
+	op->len     = instruction_length[opcode];
+	op->imm     = (op->len > 1) ? code[1] : 0;
+	op->imm    |= (op->len > 2) ? code[2]<<8 : 0;
+	op->cycles  = cycles_main_opcodes[opcode];
+	op->handler = instructions[opcode];
+	op->opcode  = opcode;
+	op->imm2    = 0;
+	op->instructions = 1;
+
+	if (opcode == 0xCB) {
+		op->cycles += cycles_0xCB_opcodes[op->imm];
+		op->handler = cb_instructions[op->imm];
+	}
+}
+
+// unconditional control transfers, conditional ones may fall through so blocks go on
+static bool cpu_ends_block (uint8_t opcode) {
+	switch (opcode) {
+	case 0x10: // STOP
+	case 0x18: // JR
+	case 0x76: // HALT
+	case 0xC3: // JP
+	case 0xC9: // RET
+	case 0xCD: // CALL
+	case 0xD9: // RETI
+	case 0xE9: // JP (HL)
+	case 0xC7: case 0xCF: case 0xD7: case 0xDF: // RST
+	case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// plain memory the code at addr lives in, limit is the last address of that memory
+static const uint8_t *cpu_code_ptr (uint16_t addr, uint16_t *limit) {
+	if (addr <= 0x00FF && cpu.boot_rom_enabled) {
+		*limit = 0x00FF;
+		return &boot_rom[addr];
+	}
+	else if (addr <= 0x3FFF) {
+		*limit = 0x3FFF;
+		return rom_get_ptr(addr);
+	}
+	else if (addr <= 0x7FFF) {
+		*limit = 0x7FFF;
+		return rom_get_ptr(addr);
+	}
+	else if (addr >= 0xC000 && addr <= 0xDFFF) {
+		*limit = 0xDFFF;
+		return &iram[addr%0xC000];
+	}
+	else if (addr >= 0xE000 && addr <= 0xFDFF) {
+		*limit = 0xFDFF;
+		return &iram[addr%0xE000];
+	}
+	else if (addr >= 0xFF80 && addr <= 0xFFFE) {
+		*limit = 0xFFFE;
+		return &zeropage[addr%0xFF80];
+	}
+	return NULL;
+}
+
+static void cpu_mark_ram_code (const uint8_t *code, int len) {
+	for (int i = 0; i < len; ++i, ++code) {
+		if (code >= iram && code < iram + sizeof(iram)) {
+			iram_code[code - iram] = true;
+		}
+		else {
+			zeropage_code[code - zeropage] = true;
+		}
+	}
+}
+
+static void cpu_invalidate_ram_blocks (void) {
+	for (int i = 0; i < BLOCK_CACHE_SIZE; ++i) {
+		if (block_cache[i].in_ram) {
+			block_cache[i].count = 0;
+		}
+	}
+	memset(iram_code, 0x00, sizeof(iram_code));
+	memset(zeropage_code, 0x00, sizeof(zeropage_code));
+	block_current = NULL;
+}
+
+static void cpu_invalidate_blocks (void) {
+	for (int i = 0; i < BLOCK_CACHE_SIZE; ++i) {
+		block_cache[i].count  = 0;
+		block_cache[i].native = NULL;
+	}
+	memset(iram_code, 0x00, sizeof(iram_code));
+	memset(zeropage_code, 0x00, sizeof(zeropage_code));
+	block_current = NULL;
+#ifdef JIT_AVAILABLE
+	jit_reset();
+#endif
+}
+
+// ops that only move registers around, translated code does them without calling the handler
+static bool cpu_op_inlined (uint8_t opcode) {
+	int dst = (opcode >> 3) & 0x7;
+	int src = opcode & 0x7;
+
+	if (opcode >= 0x40 && opcode <= 0x7F) {
+		// LD r, r', (HL) forms touch memory
+		return dst != 6 && src != 6;
+	}
+
+	switch (opcode) {
+	case 0x00: // NOP
+	case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E: // LD r, d8
+	case 0x01: case 0x11: case 0x21: case 0x31: // LD rr, d16
+	case 0x03: case 0x13: case 0x23: case 0x33: // INC rr
+	case 0x0B: case 0x1B: case 0x2B: case 0x3B: // DEC rr
+	case 0xC3: // JP a16, writes pc and ends the block
+	case 0x18: // JR r8, writes pc and ends the block
+		return true;
+	default:
+		return false;
+	}
+}
+
+// a fused op covers more bytes than its first opcode alone
+static bool cpu_op_fused (const micro_op *op) {
+	return op->len > instruction_length[op->opcode];
+}
+
+#ifdef JIT_AVAILABLE
+#define CPU_OFFSET(field) ((int) offsetof(cpu_state, field))
+
+// register operand of LD r,r' style opcodes, index 6 is (HL) and has no offset
+static const int cpu_reg_offset[8] = {
+	CPU_OFFSET(b), CPU_OFFSET(c), CPU_OFFSET(d), CPU_OFFSET(e),
+	CPU_OFFSET(h), CPU_OFFSET(l), -1, CPU_OFFSET(a)
+};
+
+static const int cpu_reg16_offset[4] = {
+	CPU_OFFSET(bc), CPU_OFFSET(de), CPU_OFFSET(hl), CPU_OFFSET(sp)
+};
+
+static void cpu_jit_inline (const micro_op *op) {
+	uint8_t opcode = op->opcode;
+	int     dst    = (opcode >> 3) & 0x7;
+	int     src    = opcode & 0x7;
+
+	switch (opcode) {
+	case 0x00: // NOP
+		break;
+	case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E: // LD r, d8
+		jit_store8(cpu_reg_offset[dst], op->imm);
+		break;
+	case 0x01: case 0x11: case 0x21: case 0x31: // LD rr, d16
+		jit_store16(cpu_reg16_offset[opcode >> 4], op->imm);
+		break;
+	case 0x03: case 0x13: case 0x23: case 0x33: // INC rr
+		jit_inc16(cpu_reg16_offset[opcode >> 4]);
+		break;
+	case 0x0B: case 0x1B: case 0x2B: case 0x3B: // DEC rr
+		jit_dec16(cpu_reg16_offset[opcode >> 4]);
+		break;
+	case 0xC3: // JP a16
+		jit_store16(CPU_OFFSET(pc), op->imm);
+		break;
+	case 0x18: // JR r8
+		jit_store16(CPU_OFFSET(pc), op->pc + op->len + (int8_t) op->imm);
+		break;
+	default:
+		// LD r, r'
+		if (dst != src) {
+			jit_copy8(cpu_reg_offset[dst], cpu_reg_offset[src]);
+		}
+		break;
+	}
+}
+
+// host address of a WRAM or HRAM byte and its code flag, NULL for the rest of the bus
+static uint8_t *cpu_jit_ram (uint16_t addr, bool **code) {
+	if (addr >= 0xC000 && addr <= 0xDFFF) {
+		*code = &iram_code[addr%0xC000];
+		return &iram[addr%0xC000];
+	}
+	if (addr >= 0xFF80 && addr <= 0xFFFE) {
+		*code = &zeropage_code[addr%0xFF80];
+		return &zeropage[addr%0xFF80];
+	}
+	return NULL;
+}
+
+/*
+ * Loads and stores that hit WRAM or HRAM skip the handler and the bus
+ * decode. Anything the fast path can't prove safe (trapped bus, another
+ * region, a write over translated code) takes the handler. Returns false
+ * when the op has no fast path at all.
+ */
+static bool cpu_jit_ram_op (const micro_op *op) {
+	uint8_t  opcode = op->opcode;
+	int      dst    = (opcode >> 3) & 0x7;
+	int      src    = opcode & 0x7;
+	uint8_t *ram;
+	bool    *code;
+
+	switch (opcode) {
+	case 0x46: case 0x4E: case 0x56: case 0x5E: case 0x66: case 0x6E: case 0x7E: // LD r, (HL)
+		jit_slow_if_set8_ptr(&bus_trapped);
+		jit_slow_if_outside16(CPU_OFFSET(hl), 0xC000, 0x2000);
+		jit_load8_indexed(cpu_reg_offset[dst], iram);
+		return true;
+	case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x77: // LD (HL), r
+		jit_slow_if_set8_ptr(&bus_trapped);
+		jit_slow_if_outside16(CPU_OFFSET(hl), 0xC000, 0x2000);
+		jit_slow_if_set8_indexed(iram_code);
+		jit_store8_indexed(iram, cpu_reg_offset[src]);
+		return true;
+	case 0xF0: // LDH A, (a8)
+	case 0xFA: // LD A, (a16)
+		ram = cpu_jit_ram(opcode == 0xF0 ? 0xFF00 + (op->imm & 0xFF) : op->imm, &code);
+		if (ram == NULL) {
+			return false;
+		}
+		jit_slow_if_set8_ptr(&bus_trapped);
+		jit_load8_ptr(CPU_OFFSET(a), ram);
+		return true;
+	case 0xE0: // LDH (a8), A
+	case 0xEA: // LD (a16), A
+		ram = cpu_jit_ram(opcode == 0xE0 ? 0xFF00 + (op->imm & 0xFF) : op->imm, &code);
+		if (ram == NULL) {
+			return false;
+		}
+		jit_slow_if_set8_ptr(&bus_trapped);
+		jit_slow_if_set8_ptr(code);
+		jit_store8_ptr(ram, CPU_OFFSET(a));
+		return true;
+	default:
+		return false;
+	}
+}
+
+// cpu_coverage_mark for one op, the map address is known once the block is translated
+static void cpu_jit_coverage (const code_block *block, const micro_op *op) {
+	uint32_t bit = block->coverage + (op->pc - block->pc);
+
+	jit_or16_ptr(&coverage_map[bit >> 3], ((1u << op->len) - 1) << (bit & 0x7));
+#ifdef COVERAGE_COUNTS
+	jit_inc32_ptr(&coverage_hits[bit]);
+#endif
+}
+
+/*
+ * Subroutine threaded translation: ops without side effects become host
+ * instructions, WRAM/HRAM loads and stores get a direct fast path, the
+ * rest call their handler exactly like cpu_step_real.
+ * cpu.pc is only written where a handler or the caller can see it. After
+ * each handler the block is left when the guest branched, an interrupt got
+ * pending or block_current was dropped (bank switch, DMA bus lock).
+ */
+static jit_code cpu_jit_compile (code_block *block) {
+	int      pending  = 0;     // cycles of inlined ops not yet added to cpu.cycles
+	int      retired  = 0;     // instructions of inlined ops not yet added to the stats
+	bool     pc_stale = false; // inlined ops leave cpu.pc behind
+	uint16_t pc       = block->pc;
+	bool     covered  = coverage_rom_size > 0 && block->coverage != coverage_rom_size;
+
+	if (!jit_begin()) {
+		// arena is full, start over with only this block, natives of an --aot object stay
+		for (int i = 0; i < BLOCK_CACHE_SIZE; ++i) {
+			if (jit_owns(block_cache[i].native)) {
+				block_cache[i].native = NULL;
+			}
+		}
+		jit_reset();
+		if (!jit_begin()) {
+			return NULL;
+		}
+	}
+
+	for (int i = 0; i < block->count; ++i) {
+		const micro_op *op = &block->ops[i];
+
+		pc = op->pc + op->len;
+		// marked before the op, like the interpreter does, so a block left early only marks what ran
+		if (covered) {
+			cpu_jit_coverage(block, op);
+		}
+		if (!cpu_op_fused(op) && cpu_op_inlined(op->opcode)) {
+			cpu_jit_inline(op);
+			pending += op->cycles;
+			retired += op->instructions;
+			// JP and JR write pc themselves and always end the block
+			pc_stale = (op->opcode != 0xC3 && op->opcode != 0x18);
+			continue;
+		}
+
+		// handlers may look at the clock through the timer registers
+		if (pending > 0) {
+			jit_add64(CPU_OFFSET(cycles), pending);
+			pending = 0;
+		}
+		// the op always runs once it is reached, exits only skip the ones after it
+		jit_add64_ptr(&stats.instructions, retired + op->instructions);
+		retired = 0;
+		// a RAM access can't branch, raise an interrupt or switch banks, so only the slow path checks
+		uint8_t *fast = NULL;
+		if (!cpu_op_fused(op) && cpu_jit_ram_op(op)) {
+			jit_add64(CPU_OFFSET(cycles), op->cycles);
+			fast = jit_else();
+		}
+
+		jit_store16(CPU_OFFSET(pc), pc);
+		jit_store16(CPU_OFFSET(imm), op->imm);
+		if (cpu_op_fused(op)) {
+			jit_store8(CPU_OFFSET(imm2), op->imm2);
+		}
+		jit_call(op->handler, op->cycles, CPU_OFFSET(cycles));
+
+		if (i + 1 < block->count) {
+			jit_exit_if_ne16(CPU_OFFSET(pc), pc);
+			jit_exit_if_set8(CPU_OFFSET(int_pending));
+			jit_exit_if_ptr_ne((void *const *) &block_current, block);
+		}
+
+		pc_stale = (fast != NULL);
+		if (fast != NULL) {
+			jit_end_if(fast);
+		}
+	}
+
+	if (pending > 0) {
+		jit_add64(CPU_OFFSET(cycles), pending);
+	}
+	if (retired > 0) {
+		jit_add64_ptr(&stats.instructions, retired);
+	}
+	if (pc_stale) {
+		jit_store16(CPU_OFFSET(pc), pc);
+	}
+
+	return jit_end();
+}
+#endif /* JIT_AVAILABLE */
+
+// native code keeps cpu.cycles current for handlers, cpu_step adds the total itself
+// one OR of a 16 bit window covers every op up to 9 bytes long at any bit, the map is little endian on all hosts we run on
+static inline ALWAYS_INLINE void cpu_coverage_mark (const micro_op *op) {
+	uint32_t bit  = coverage_base + op->pc;
+	uint16_t mask = ((1u << op->len) - 1) << (bit & 0x7);
+	uint16_t window;
+
+	memcpy(&window, &coverage_map[bit >> 3], sizeof(window));
+	window |= mask;
+	memcpy(&coverage_map[bit >> 3], &window, sizeof(window));
+#ifdef COVERAGE_COUNTS
+	coverage_hits[bit]++;
+#endif
+}
+
+static int cpu_run_native (code_block *block) {
+	uint64_t start = cpu.cycles;
+
+	block->native();
+
+	int cycles = cpu.cycles - start;
+	cpu.cycles    = start;
+	block_current = NULL;
+	return cycles;
+}
+
+void cpu_set_jit (bool enabled) {
+#ifdef JIT_AVAILABLE
+	block_jit = enabled && jit_init(&cpu);
+	cpu_invalidate_blocks();
+#else
+	if (enabled) {
+		println("Recompiler is not available on this host");
+	}
+#endif
+}
+
+// position of code in the rom file, -1 for the boot rom and RAM
+static int32_t cpu_rom_offset (const uint8_t *code) {
+	uint64_t      size  = 0;
+	const uint8_t *image = rom_get_image(&size);
+
+	if (image == NULL || code < image || code >= image + size) {
+		return -1;
+	}
+	return code - image;
+}
+
+uint32_t cpu_location (uint16_t pc) {
+	uint16_t      limit  = 0;
+	const uint8_t *code  = cpu_code_ptr(pc, &limit);
+	int32_t       offset = (code != NULL) ? cpu_rom_offset(code) : -1;
+
+	return (offset >= 0) ? (uint32_t) offset : CPU_LOCATION_BUS | pc;
+}
+
+// guest profiler hooks, calls and returns go through handlers on every path so translated code reports them too
+static bool     profiler_enabled     = false;
+static uint64_t profiler_next_sample = UINT64_MAX;
+
+// right after the return address was pushed and pc set to the target
+static inline void cpu_profiler_call (void) {
+	if (profiler_enabled) {
+		profiler_call(cpu_location(cpu.pc), cpu.sp);
+	}
+}
+
+// right after the return address was popped
+static inline void cpu_profiler_return (void) {
+	if (profiler_enabled) {
+		profiler_return(cpu.sp - 2);
+	}
+}
+
+void cpu_set_profiler (bool enabled) {
+	profiler_enabled     = enabled;
+	profiler_next_sample = enabled ? cpu.cycles + PROFILER_INTERVAL : UINT64_MAX;
+	if (enabled) {
+		profiler_start(cpu_location(cpu.pc));
+	}
+}
+
+static bool trace_enabled = false;
+
+// state before op runs, translated blocks only show up with their first op
+static void cpu_trace (const micro_op *op) {
+	static const uint8_t *block_code     = NULL;
+	static uint32_t      block_location = 0;
+	trace_record         *record        = trace_next();
+
+	// blocks never cross a bank, so one lookup per block is enough
+	if (block_current != NULL && block_current->code != block_code) {
+		block_code     = block_current->code;
+		block_location = cpu_location(block_current->pc);
+	}
+
+	cpu_flags_sync();
+	record->cycles   = cpu.cycles;
+	record->location = (block_current != NULL) ? block_location + (op->pc - block_current->pc) : cpu_location(op->pc);
+	record->pc       = op->pc;
+	record->af       = cpu.af;
+	record->bc       = cpu.bc;
+	record->de       = cpu.de;
+	record->hl       = cpu.hl;
+	record->sp       = cpu.sp;
+	record->opcode   = op->opcode;
+	record->len      = op->len;
+	record->imm      = op->imm;
+	record->imm2     = op->imm2;
+}
+
+void cpu_set_trace (bool enabled) {
+	trace_enabled = enabled;
+}
+
+static void cpu_decode_block (code_block *block, uint16_t pc, const uint8_t *code, uint16_t limit) {
+	block->code   = code;
+	block->pc     = pc;
+	block->count  = 0;
+	block->cycles = 0;
+	block->hits   = 0;
+	block->native = NULL;
+	block->in_ram = (pc >= 0xC000);
+
+	while (block->count < BLOCK_MAX_OPS && pc <= limit) {
+		uint8_t opcode = code[0];
+		int     len    = instruction_length[opcode];
+
+		// operands may not run past the end of this memory, the bus decodes those
+		if (pc + len - 1 > limit) {
+			break;
+		}
+
+		micro_op *op = &block->ops[block->count++];
+		cpu_decode(op, pc, code);
+		block->cycles += op->cycles;
+		if (block->in_ram) {
+			cpu_mark_ram_code(code, len);
+		}
+
+		if (cpu_ends_block(opcode)) {
+			break;
+		}
+		pc   += len;
+		code += len;
+	}
+}
+
+static const fuse_candidate *cpu_fuse_match (const code_block *block, int index) {
+	for (int i = 0; i < FUSE_CANDIDATES; ++i) {
+		const fuse_candidate *candidate = &fuse_candidates[i];
+		int                  j          = 0;
+
+		if (!fuse_enabled[i] || index + candidate->count > block->count) {
+			continue;
+		}
+		while (j < candidate->count && block->ops[index + j].opcode == candidate->opcodes[j]) {
+			j++;
+		}
+		if (j == candidate->count) {
+			return candidate;
+		}
+	}
+	return NULL;
+}
+
+// RAM blocks stay as they are, a write in the middle of a fused op could change the ops after it
+static void cpu_fuse_block (code_block *block) {
+	int count = 0;
+
+	for (int i = 0; i < block->count; ++i) {
+		const fuse_candidate *candidate = cpu_fuse_match(block, i);
+		micro_op             merged     = block->ops[i];
+
+		if (candidate != NULL) {
+			uint8_t operands[FUSE_MAX_OPS] = {0};
+			int     bytes                  = 0;
+
+			merged.len    = 0;
+			merged.cycles = 0;
+			for (int j = 0; j < candidate->count; ++j) {
+				const micro_op *part = &block->ops[i + j];
+
+				merged.len    += part->len;
+				merged.cycles += part->cycles;
+				for (int k = 1; k < part->len; ++k) {
+					operands[bytes++] = part->imm >> ((k - 1)*8);
+				}
+			}
+			merged.handler      = candidate->handler;
+			merged.instructions = candidate->count;
+			merged.imm     = operands[0] | (operands[1] << 8);
+			merged.imm2    = operands[2];
+			i += candidate->count - 1;
+		}
+		block->ops[count++] = merged;
+	}
+	block->count = count;
+}
+
+// only sees interpreted ops, translated blocks run past it
+static void cpu_fuse_count (const micro_op *op) {
+	// interrupts and taken branches start a new sequence
+	if (op->pc != fuse_next_pc) {
+		fuse_history_len = 0;
+	}
+	if (fuse_history_len < FUSE_MAX_OPS) {
+		fuse_history_len++;
+	}
+	fuse_history = (fuse_history << 8) | op->opcode;
+	fuse_next_pc = op->pc + op->len;
+	fuse_total++;
+
+	for (int i = 0; i < FUSE_CANDIDATES; ++i) {
+		const fuse_candidate *candidate = &fuse_candidates[i];
+		uint32_t             sequence   = 0;
+
+		if (candidate->count > fuse_history_len) {
+			continue;
+		}
+		for (int j = 0; j < candidate->count; ++j) {
+			sequence = (sequence << 8) | candidate->opcodes[j];
+		}
+		if ((fuse_history & ((1u << (candidate->count*8)) - 1)) == sequence) {
+			fuse_counts[i]++;
+		}
+	}
+}
+
+static code_block *cpu_block_lookup (uint16_t pc) {
+	uint16_t      limit = 0;
+	const uint8_t *code = cpu_code_ptr(pc, &limit);
+	if (code == NULL) {
+		return NULL;
+	}
+
+	// slot comes from rom offset (bank and address), host addresses would change eviction from run to run
+	int32_t    offset = cpu_rom_offset(code);
+	uint32_t   key    = (offset >= 0) ? (uint32_t) offset : pc;
+	code_block *block = &block_cache[(key ^ (key >> 12)) & (BLOCK_CACHE_SIZE - 1)];
+	if (block->count > 0 && block->code == code && block->pc == pc) {
+#ifdef JIT_AVAILABLE
+		if (block_jit && !block->in_ram && !block->breaks && block->native == NULL && ++block->hits >= BLOCK_JIT_HITS) {
+			block->native = cpu_jit_compile(block);
+		}
+#endif
+		return block;
+	}
+
+	cpu_decode_block(block, pc, code, limit);
+	block->breaks = false;
+	for (int i = 0; break_active && i < block->count; ++i) {
+		if (breakpoint_at(block->ops[i].pc)) {
+			block->ops[i].handler = cpu_instr_break;
+			block->breaks         = true;
+		}
+	}
+	if (fuse_active && !block->in_ram && !block->breaks) {
+		cpu_fuse_block(block);
+	}
+	block->coverage = coverage_rom_size;
+	if (block->count > 0 && offset >= 0) {
+		const micro_op *last = &block->ops[block->count - 1];
+
+		if ((uint32_t) offset + (last->pc + last->len - pc) <= coverage_rom_size) {
+			block->coverage = offset;
+		}
+	}
+	if (offset >= 0) {
+		// translated code only marks coverage inside the rom
+		bool sink = coverage_rom_size > 0 && block->coverage == coverage_rom_size;
+		block->native = (block->breaks || sink) ? NULL : aot_find(offset);
+		if (aot_seen != NULL) {
+			aot_seen[offset >> 3] |= 1 << (offset & 0x7);
+		}
+	}
+
+	return (block->count > 0) ? block : NULL;
+}
+
+/*
+ * Ahead of time translation. Blocks reachable from the reset and interrupt
+ * vectors through static branch targets are walked, plus every block the
+ * interpreter started while recording, that covers jump tables and calls
+ * into banks the walk can't know. Each block becomes a C function doing
+ * what cpu_jit_compile output does.
+ */
+static const char *aot_reg_names[8]   = {"b", "c", "d", "e", "h", "l", NULL, "a"};
+static const char *aot_reg16_names[4] = {"bc", "de", "hl", "sp"};
+
+static void cpu_aot_inline (FILE *out, const micro_op *op) {
+	uint8_t opcode = op->opcode;
+	int     dst    = (opcode >> 3) & 0x7;
+	int     src    = opcode & 0x7;
+
+	switch (opcode) {
+	case 0x00: // NOP
+		break;
+	case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E: // LD r, d8
+		fprintf(out, "\tcpu->%s = 0x%02x;\n", aot_reg_names[dst], op->imm);
+		break;
+	case 0x01: case 0x11: case 0x21: case 0x31: // LD rr, d16
+		fprintf(out, "\tcpu->%s = 0x%04x;\n", aot_reg16_names[opcode >> 4], op->imm);
+		break;
+	case 0x03: case 0x13: case 0x23: case 0x33: // INC rr
+		fprintf(out, "\tcpu->%s++;\n", aot_reg16_names[opcode >> 4]);
+		break;
+	case 0x0B: case 0x1B: case 0x2B: case 0x3B: // DEC rr
+		fprintf(out, "\tcpu->%s--;\n", aot_reg16_names[opcode >> 4]);
+		break;
+	case 0xC3: // JP a16
+		fprintf(out, "\tcpu->pc = 0x%04x;\n", op->imm);
+		break;
+	case 0x18: // JR r8
+		fprintf(out, "\tcpu->pc = 0x%04x;\n", (uint16_t) (op->pc + op->len + (int8_t) op->imm));
+		break;
+	default:
+		// LD r, r'
+		if (dst != src) {
+			fprintf(out, "\tcpu->%s = cpu->%s;\n", aot_reg_names[dst], aot_reg_names[src]);
+		}
+		break;
+	}
+}
+
+static void cpu_aot_emit_block (FILE *out, const code_block *block, uint32_t offset) {
+	int      pending  = 0;
+	int      retired  = 0;
+	bool     pc_stale = false;
+	bool     inlined  = false;
+	bool     calls    = false;
+	uint16_t pc       = block->pc;
+
+	for (int i = 0; i < block->count; ++i) {
+		inlined |= cpu_op_inlined(block->ops[i].opcode);
+		calls   |= !cpu_op_inlined(block->ops[i].opcode);
+	}
+
+	fprintf(out, "\n// bank %u, 0x%04x\nstatic void block_%06x (void) {\n", offset >> 14, block->pc, offset);
+	if (inlined) {
+		fprintf(out, "\tcpu_state  *cpu  = env->cpu;\n");
+	}
+	if (calls) {
+		fprintf(out, "\tconst void *self = *env->current;\n");
+	}
+	fprintf(out, "\n");
+
+	for (int i = 0; i < block->count; ++i) {
+		const micro_op *op = &block->ops[i];
+
+		pc = op->pc + op->len;
+		fprintf(out, "\tcover(0x%06x, %d);\n", offset + (op->pc - block->pc), op->len);
+		if (!cpu_op_fused(op) && cpu_op_inlined(op->opcode)) {
+			cpu_aot_inline(out, op);
+			pending += op->cycles;
+			retired += op->instructions;
+			pc_stale = (op->opcode != 0xC3 && op->opcode != 0x18);
+			continue;
+		}
+
+		if (pending > 0) {
+			fprintf(out, "\tcpu->cycles += %d;\n", pending);
+			pending = 0;
+		}
+		fprintf(out, "\t*env->instructions += %d;\n", retired + op->instructions);
+		retired = 0;
+		fprintf(out, "\t%sstep(0x%04x, 0x%04x, %d, env->%s[0x%02x], self)%s\n",
+			(i + 1 < block->count) ? "if (!" : "",
+			pc, op->imm, op->cycles,
+			(op->opcode == 0xCB) ? "cb_ops" : "main_ops", (op->opcode == 0xCB) ? op->imm : op->opcode,
+			(i + 1 < block->count) ? ") return;" : ";");
+		pc_stale = false;
+	}
+
+	if (pending > 0) {
+		fprintf(out, "\tcpu->cycles += %d;\n", pending);
+	}
+	if (retired > 0) {
+		fprintf(out, "\t*env->instructions += %d;\n", retired);
+	}
+	if (pc_stale) {
+		fprintf(out, "\tcpu->pc = 0x%04x;\n", pc);
+	}
+	fprintf(out, "}\n");
+}
+
+// rom offset of a branch target, -1 when that depends on which bank is mapped at runtime
+static int64_t cpu_aot_target (uint32_t from, uint16_t target, uint64_t size) {
+	if (target <= 0x3FFF) {
+		return target;
+	}
+	if (target > 0x7FFF) {
+		return -1;
+	}
+	if (from > 0x3FFF) {
+		// banked code jumping around inside its own bank
+		return (from & ~0x3FFF) + (target - 0x4000);
+	}
+	// without a mapper bank 1 is always there
+	return (size <= 0x8000) ? target : -1;
+}
+
+static void cpu_aot_decode (code_block *block, uint32_t offset, const uint8_t *image) {
+	uint16_t pc    = (offset <= 0x3FFF) ? offset : 0x4000 | (offset & 0x3FFF);
+	uint16_t limit = (offset <= 0x3FFF) ? 0x3FFF : 0x7FFF;
+
+	cpu_decode_block(block, pc, image + offset, limit);
+}
+
+void cpu_coverage_record (void) {
+	uint64_t      size  = 0;
+	const uint8_t *image = rom_get_image(&size);
+
+	if (image == NULL || !coverage_start(image, rom_size(image))) {
+		return;
+	}
+	coverage_map      = coverage_bits();
+	coverage_hits     = coverage_counts();
+	coverage_rom_size = rom_size(image);
+	aot_bound.coverage = coverage_map;
+#ifdef COVERAGE_COUNTS
+	aot_bound.coverage_hits = coverage_hits;
+#endif
+	// blocks decoded before now point at the sink
+	cpu_invalidate_blocks();
+}
+
+void cpu_aot_record (void) {
+	uint64_t size = 0;
+
+	if (rom_get_image(&size) == NULL) {
+		return;
+	}
+	free(aot_seen);
+	aot_seen = calloc(size/8 + 1, sizeof(uint8_t));
+	// blocks decoded before now would never be seen again
+	cpu_invalidate_blocks();
+}
+
+bool cpu_aot_generate (const char *path) {
+	static const uint16_t vectors[] = {
+		0x0100, 0x0000, 0x0008, 0x0010, 0x0018, 0x0020, 0x0028, 0x0030, 0x0038,
+		0x0040, 0x0048, 0x0050, 0x0058, 0x0060
+	};
+	static code_block block;
+	uint64_t          size   = 0;
+	const uint8_t     *image = rom_get_image(&size);
+	int               count  = 0;
+	int               total  = 0;
+
+	if (image == NULL || size < 0x8000) {
+		println("No rom to translate");
+		return false;
+	}
+
+	uint64_t rom_hash = aot_hash(image, size);
+
+	// whole banks only, a block never reads past its bank
+	size &= ~(uint64_t) 0x3FFF;
+
+	uint8_t  *queued = calloc(size/8 + 1, sizeof(uint8_t));
+	uint32_t *work   = malloc(size*sizeof(uint32_t));
+
+#define AOT_QUEUE(target) do { \
+		int64_t at_ = (target); \
+		if (at_ >= 0 && (uint64_t) at_ < size && !(queued[at_ >> 3] & (1 << (at_ & 0x7)))) { \
+			queued[at_ >> 3] |= 1 << (at_ & 0x7); \
+			work[count++] = at_; \
+		} \
+	} while (0)
+
+	for (int i = 0; i < (int) (sizeof(vectors)/sizeof(vectors[0])); ++i) {
+		AOT_QUEUE(vectors[i]);
+	}
+	for (uint64_t offset = 0; aot_seen != NULL && offset < size; ++offset) {
+		if (aot_seen[offset >> 3] & (1 << (offset & 0x7))) {
+			AOT_QUEUE(offset);
+		}
+	}
+
+	while (count > 0) {
+		uint32_t offset = work[--count];
+
+		cpu_aot_decode(&block, offset, image);
+		for (int i = 0; i < block.count; ++i) {
+			const micro_op *op = &block.ops[i];
+			uint8_t        opcode = op->opcode;
+
+			switch (opcode) {
+			case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: // JR
+				AOT_QUEUE(cpu_aot_target(offset, op->pc + op->len + (int8_t) op->imm, size));
+				break;
+			case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: // JP
+			case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC: // CALL
+				AOT_QUEUE(cpu_aot_target(offset, op->imm, size));
+				break;
+			default:
+				if ((opcode & 0xC7) == 0xC7) {
+					// RST
+					AOT_QUEUE(opcode & 0x38);
+				}
+				break;
+			}
+		}
+
+		// calls, RST, HALT and STOP come back to the next op, only jumps and returns don't
+		if (block.count > 0) {
+			const micro_op *last = &block.ops[block.count - 1];
+			uint32_t       next  = (last->pc + last->len) & 0x3FFF;
+
+			switch (last->opcode) {
+			case 0x18: case 0xC3: case 0xC9: case 0xD9: case 0xE9:
+				break;
+			default:
+				if (next != 0) {
+					AOT_QUEUE((offset & ~0x3FFF) + next);
+				}
+				break;
+			}
+		}
+	}
+#undef AOT_QUEUE
+
+	FILE *out = fopen(path, "w");
+	if (out == NULL) {
+		println("Failed to open '%s'", path);
+		free(queued);
+		free(work);
+		return false;
+	}
+
+	fprintf(out, "/* translated rom code written by smallconsole --aot-gen, build with tools/aot.sh */\n");
+	fprintf(out, "#include \"aot.h\"\n\n");
+	fprintf(out, "static const aot_env *env;\n\n");
+	fprintf(out, "// one op through its handler, false when the block has to be left\n");
+	fprintf(out, "static inline bool step (uint16_t pc, uint16_t imm, int cycles, aot_handler handler, const void *self) {\n");
+	fprintf(out, "\tcpu_state *cpu = env->cpu;\n\n");
+	fprintf(out, "\tcpu->pc  = pc;\n\tcpu->imm = imm;\n\thandler(&cycles);\n\tcpu->cycles += cycles;\n");
+	fprintf(out, "\treturn cpu->pc == pc && !cpu->int_pending && *env->current == self;\n}\n\n");
+	fprintf(out, "// marks the op at a rom offset like the interpreter does, while coverage is recorded\n");
+	fprintf(out, "static inline void cover (uint32_t bit, int len) {\n");
+	fprintf(out, "\tuint16_t mask = ((1u << len) - 1) << (bit & 0x7);\n\n");
+	fprintf(out, "\tif (env->coverage == NULL) {\n\t\treturn;\n\t}\n");
+	fprintf(out, "\tenv->coverage[bit >> 3]       |= mask;\n\tenv->coverage[(bit >> 3) + 1] |= mask >> 8;\n");
+	fprintf(out, "\tif (env->coverage_hits != NULL) {\n\t\tenv->coverage_hits[bit]++;\n\t}\n}\n");
+
+	for (uint64_t offset = 0; offset < size; ++offset) {
+		if (queued[offset >> 3] & (1 << (offset & 0x7))) {
+			cpu_aot_decode(&block, offset, image);
+			if (block.count > 0) {
+				cpu_aot_emit_block(out, &block, offset);
+				total++;
+			}
+		}
+	}
+
+	fprintf(out, "\nconst int      aot_abi_version = AOT_ABI_VERSION;\n");
+	fprintf(out, "const uint64_t aot_rom_hash    = 0x%016llxULL;\n", (unsigned long long) rom_hash);
+	fprintf(out, "const int      aot_block_count = %d;\n\n", total);
+	fprintf(out, "const aot_block aot_blocks[] = {\n");
+	for (uint64_t offset = 0; offset < size; ++offset) {
+		if (queued[offset >> 3] & (1 << (offset & 0x7))) {
+			cpu_aot_decode(&block, offset, image);
+			if (block.count > 0) {
+				fprintf(out, "\t{0x%06x, block_%06x},\n", (uint32_t) offset, (uint32_t) offset);
+			}
+		}
+	}
+	fprintf(out, "};\n\nvoid aot_bind (const aot_env *bound) {\n\tenv = bound;\n}\n");
+	fclose(out);
+
+	println("Wrote %d translated blocks to '%s'", total, path);
+	free(queued);
+	free(work);
+	return true;
+}
+
+bool cpu_aot_load (const char *path) {
+	uint64_t      size   = 0;
+	const uint8_t *image = rom_get_image(&size);
+
+	if (image == NULL || size < 0x150) {
+		println("Load a rom before its translation");
+		return false;
+	}
+
+	aot_bound.cpu          = &cpu;
+	aot_bound.current      = (void *const *) &block_current;
+	aot_bound.main_ops     = instructions;
+	aot_bound.cb_ops       = cb_instructions;
+	aot_bound.instructions = &stats.instructions;
+
+	bool loaded = aot_load(path, aot_hash(image, size), &aot_bound);
+	// blocks decoded so far don't know about the translated code
+	cpu_invalidate_blocks();
+	return loaded;
+}
+
+void cpu_fuse_record (void) {
+	memset(fuse_counts, 0x00, sizeof(fuse_counts));
+	fuse_total       = 0;
+	fuse_history_len = 0;
+	fuse_recording   = true;
+	// counting needs the plain ops
+	memset(fuse_enabled, 0x00, sizeof(fuse_enabled));
+	fuse_active = false;
+	cpu_invalidate_blocks();
+}
+
+bool cpu_fuse_write (const char *path) {
+	int order[FUSE_CANDIDATES];
+
+	FILE *out = fopen(path, "w");
+	if (out == NULL) {
+		println("Failed to open '%s'", path);
+		return false;
+	}
+
+	// most executed first
+	for (int i = 0; i < FUSE_CANDIDATES; ++i) {
+		int j = i;
+		while (j > 0 && fuse_counts[order[j - 1]] < fuse_counts[i]) {
+			order[j] = order[j - 1];
+			j--;
+		}
+		order[j] = i;
+	}
+
+	fprintf(out, "# sequence, times it ran, share of all %llu ops. Lines starting with # are not fused\n",
+		(unsigned long long) fuse_total);
+	for (int i = 0; i < FUSE_CANDIDATES; ++i) {
+		uint64_t count = fuse_counts[order[i]];
+		bool     hot   = count > 0 && count*FUSE_MIN_SHARE >= fuse_total;
+
+		fprintf(out, "%s%s %llu %.2f%%\n", hot ? "" : "# ", fuse_candidates[order[i]].name,
+			(unsigned long long) count, fuse_total ? 100.0*count/fuse_total : 0.0);
+	}
+	fclose(out);
+
+	println("Wrote fusion profile to '%s'", path);
+	return true;
+}
+
+bool cpu_fuse_load (const char *path) {
+	char line[256];
+	char name[64];
+	int  enabled = 0;
+
+	FILE *in = fopen(path, "r");
+	if (in == NULL) {
+		println("Failed to open fusion profile '%s'", path);
+		return false;
+	}
+
+	memset(fuse_enabled, 0x00, sizeof(fuse_enabled));
+	while (fgets(line, sizeof(line), in) != NULL) {
+		int i = 0;
+
+		if (line[0] == '#' || sscanf(line, "%63s", name) != 1) {
+			continue;
+		}
+		while (i < FUSE_CANDIDATES && strcmp(name, fuse_candidates[i].name) != 0) {
+			i++;
+		}
+		if (i == FUSE_CANDIDATES) {
+			println("Unknown sequence '%s' in fusion profile", name);
+			continue;
+		}
+		fuse_enabled[i] = true;
+		enabled++;
+	}
+	fclose(in);
+
+	fuse_active = enabled > 0;
+	// blocks decoded so far are not fused
+	cpu_invalidate_blocks();
+	println("Fusing %d opcode sequences from '%s'", enabled, path);
+	return true;
+}
+
+#ifdef OPCODE_PROFILER
+#define PROFILE_TOP_PAIRS 32
+
+/*
+ * Opcode mix of interpreted code, translated blocks run past it and fused
+ * ops count as their first opcode. Main table entries are counted by first
+ * byte, so 0xCB covers all of the CB table. Pairs only count when the second
+ * op directly follows the first.
+ */
+static uint64_t profile_main_count[256];
+static uint64_t profile_main_cycles[256];
+static uint64_t profile_cb_count[256];
+static uint64_t profile_cb_cycles[256];
+static uint64_t profile_pairs[0x10000];
+static uint8_t  profile_last_opcode = 0;
+static uint16_t profile_next_pc     = 0;
+
+static inline void cpu_profile_op (const micro_op *op, int cycles) {
+	profile_main_count[op->opcode]++;
+	profile_main_cycles[op->opcode] += cycles;
+	if (op->opcode == 0xCB) {
+		profile_cb_count[op->imm & 0xFF]++;
+		profile_cb_cycles[op->imm & 0xFF] += cycles;
+	}
+	if (op->pc == profile_next_pc) {
+		profile_pairs[(profile_last_opcode << 8) | op->opcode]++;
+	}
+	profile_last_opcode = op->opcode;
+	profile_next_pc     = op->pc + op->len;
+}
+
+static const uint64_t *profile_sort_counts = NULL;
+
+static int cpu_profile_compare (const void *a, const void *b) {
+	uint64_t count_a = profile_sort_counts[*(const int *) a];
+	uint64_t count_b = profile_sort_counts[*(const int *) b];
+
+	return (count_a < count_b) - (count_a > count_b);
+}
+
+static void cpu_profile_print_table (const char *title, const char *prefix, const uint64_t *count, const uint64_t *cycles) {
+	int      order[256];
+	uint64_t total = 0;
+
+	for (int i = 0; i < 256; ++i) {
+		order[i] = i;
+		total   += count[i];
+	}
+	profile_sort_counts = count;
+	qsort(order, 256, sizeof(int), cpu_profile_compare);
+
+	println("%s, %llu ops", title, (unsigned long long) total);
+	println("opcode        count   share      cycles  avg");
+	for (int i = 0; i < 256 && count[order[i]] > 0; ++i) {
+		int op = order[i];
+		println("%s%02X %14llu %6.2f%% %12llu %4.1f", prefix, op, (unsigned long long) count[op],
+			100.0*count[op]/total, (unsigned long long) cycles[op], (double) cycles[op]/count[op]);
+	}
+}
+
+void cpu_profile_report (void) {
+	uint64_t pairs = 0;
+
+	cpu_profile_print_table("Main opcodes", "   ", profile_main_count, profile_main_cycles);
+	cpu_profile_print_table("CB opcodes", "CB ", profile_cb_count, profile_cb_cycles);
+
+	for (int i = 0; i < 0x10000; ++i) {
+		pairs += profile_pairs[i];
+	}
+	println("Most common opcode pairs, %llu pairs", (unsigned long long) pairs);
+	for (int n = 0; n < PROFILE_TOP_PAIRS; ++n) {
+		int best = 0;
+
+		// a copy of the table would be 512k, picking the maximum 32 times is cheap enough at exit
+		for (int i = 1; i < 0x10000; ++i) {
+			if (profile_pairs[i] > profile_pairs[best]) {
+				best = i;
+			}
+		}
+		if (profile_pairs[best] == 0) {
+			break;
+		}
+		println("%02X %02X %14llu %6.2f%%", best >> 8, best & 0xFF,
+			(unsigned long long) profile_pairs[best], 100.0*profile_pairs[best]/pairs);
+		profile_pairs[best] = 0;
+	}
+}
+
+#define PROFILE_OP(op, cycles) cpu_profile_op(op, cycles)
+#else
+#define PROFILE_OP(op, cycles)
+#endif /* OPCODE_PROFILER */
+
+static micro_op block_uncached; // last op decoded outside of any block
+
+// instruction bytes, they see the bus lock but never count as watched reads
+static uint8_t read_byte_fetch (uint16_t addr) {
+	if (cpu.bus_locked && addr < 0xFF80) {
+		return 0xFF;
+	}
+	return read_byte_bus(addr);
+}
+
+static const micro_op *cpu_fetch_op (void) {
+	if (block_current != NULL && block_next_op < block_current->count
+		&& block_current->ops[block_next_op].pc == cpu.pc) {
+		return &block_current->ops[block_next_op++];
+	}
+
+	// while OAM DMA owns the bus the fetch has to see what the bus gives
+	block_current = cpu.bus_locked ? NULL : cpu_block_lookup(cpu.pc);
+	if (block_current != NULL) {
+		block_next_op = 1;
+		coverage_base = block_current->coverage - block_current->pc;
+		return &block_current->ops[0];
+	}
+	coverage_base = coverage_rom_size - cpu.pc;
+
+	uint8_t code[3] = {read_byte_fetch(cpu.pc), 0, 0};
+	for (int i = 1; i < instruction_length[code[0]]; ++i) {
+		code[i] = read_byte_fetch(cpu.pc + i);
+	}
+	cpu_decode(&block_uncached, cpu.pc, code);
+	if (break_active && breakpoint_at(cpu.pc)) {
+		block_uncached.handler = cpu_instr_break;
+	}
+	return &block_uncached;
+}
+
 void cpu_init () {
 	cpu.stop             = false;
+	cpu.halted           = false;
 	cpu.pc               = 0x0000;
 	cpu.sp               = 0x0000;
 	cpu.ime              = 0;
+	cpu.ime_delay        = 0;
+	cpu.int_pending      = false;
 	cpu.boot_rom_enabled = 1;
 	cpu.interrupt_enable = 0;
 	cpu.interrupt_flag   = 0xE0;
+	cpu.cycles           = 0;
+	cpu.flags_op         = FLAGS_NONE;
+	cpu.bus_locked       = false;
+	bus_trapped          = bus_watched;
+
+	coverage_map      = coverage_bits();
+	coverage_hits     = coverage_counts();
+	coverage_rom_size = 0;
+	aot_bound.coverage      = NULL;
+	aot_bound.coverage_hits = NULL;
+	cpu_invalidate_blocks();
+
+	io_map(0xFF01, &serial_data, 0x00, NULL, NULL);
+	io_map(0xFF02, NULL, 0xFF, NULL, serial_write_control);
+	io_map(0xFF03, NULL, 0xFF, NULL, NULL);
+	io_map(0xFF0F, &cpu.interrupt_flag, 0xE0, NULL, cpu_write_interrupt_flag);
+	io_map(0xFF50, NULL, 0x00, cpu_read_boot_rom_reg, cpu_write_boot_rom_reg);
+	// a loaded IF has to reach int_pending like any other write
+	io_map_restore(0xFF0F, cpu_write_interrupt_flag);
+	io_map_restore(0xFF50, cpu_restore_boot_rom_reg);
+}
+
+static uint8_t cpu_read_boot_rom_reg (uint16_t addr) {
+	return cpu.boot_rom_enabled ? 1 : 0;
+}
+
+static void cpu_write_boot_rom_reg (uint16_t addr, uint8_t val) {
+	if (val == 0x1) {
+		println("Disabling boot rom!");
+		cpu.boot_rom_enabled = 0;
+		block_current        = NULL;
+	}
 }
 
-
-
-static uint8_t serial_data = 0x0;
-
-static uint8_t serial_read (void) {
-	return serial_data;
-}
-
-static void serial_write (uint8_t data) {
-	serial_data = data;
+// the saved value comes from cpu_read_boot_rom_reg, so it can turn the boot rom back on
+static void cpu_restore_boot_rom_reg (uint16_t addr, uint8_t val) {
+	cpu.boot_rom_enabled = val & 0x1;
+	block_current        = NULL;
 }
 
-static void serial_write_control (uint8_t data) {
+static void serial_write_control (uint16_t addr, uint8_t data) {
 	if (data & (1<<7)) {
 		printl("%c", serial_data);
 	}
 }
 
+// must be called after anything that touches IF, IE, IME or the halt state
+static inline void cpu_update_interrupts (void) {
+	uint8_t fired = cpu.interrupt_flag & cpu.interrupt_enable & 0x1F;
+	cpu.int_pending = (fired && (cpu.ime || cpu.halted)) || cpu.ime_delay;
+}
+
+static void cpu_write_interrupt_flag (uint16_t addr, uint8_t val) {
+	cpu.interrupt_flag = val;
+	cpu_update_interrupts();
+}
+
 static void handle_interrupts (void) {
-	if (cpu.ime) {
-		uint8_t fired = cpu.interrupt_flag & cpu.interrupt_enable;
+	uint8_t fired = cpu.interrupt_flag & cpu.interrupt_enable & 0x1F;
 
-		if (!fired) {
-			return;
-		}
+	if (cpu.ime_delay && --cpu.ime_delay == 0) {
+		cpu.ime = 1;
+	}
 
-		if (fired & 0x1) {
-			cpu_opcode_interrupt(0x40);
-			cpu.interrupt_flag &= ~(1<<0);
-		}
-		else if (fired & 0x2) {
-			cpu_opcode_interrupt(0x48);
-			cpu.interrupt_flag &= ~(1<<1);
-		}
-		else if (fired & 0x4) {
-			cpu_opcode_interrupt(0x50);
-			cpu.interrupt_flag &= ~(1<<2);
-		}
-		else if (fired & 0x8) {
-			cpu_opcode_interrupt(0x58);
-			cpu.interrupt_flag &= ~(1<<3);
-		}
-		else if (fired & 0x10) {
-			cpu_opcode_interrupt(0x60);
-			cpu.interrupt_flag &= ~(1<<4);
+	if (fired) {
+		// HALT ends on any enabled interrupt, even with IME off
+		cpu.halted = false;
+
+		if (cpu.ime) {
+			// lowest bit has the highest priority, vectors are 8 bytes apart from 0x40
+			int bit = __builtin_ctz(fired);
+			cpu.interrupt_flag &= ~(1<<bit);
+			stats.interrupts[bit]++;
+			PROBE2(interrupt, bit, cpu.pc);
+			cpu_opcode_interrupt(0x40 + bit*8);
 		}
 	}
+
+	cpu_update_interrupts();
 }
 
 uint8_t cpu_get_dma (uint8_t start_addr, uint8_t index) {
 	uint16_t addr = (start_addr<<8) | index;
-	return read_byte(addr);
+	return read_byte_bus(addr);
+}
+
+const uint8_t *cpu_get_dma_page (uint8_t start_addr) {
+	uint16_t addr = start_addr<<8;
+
+	if (addr <= 0x7FFF) {
+		if (addr <= 0x00FF && cpu.boot_rom_enabled) {
+			return boot_rom;
+		}
+		// banks are 16k aligned, so one page never crosses them
+		return rom_get_ptr(addr);
+	}
+	else if (addr >= 0xC000 && addr <= 0xDFFF) {
+		return &iram[addr%0xC000];
+	}
+	else if (addr >= 0xE000 && addr <= 0xFDFF) {
+		return &iram[addr%0xE000];
+	}
+	// vram, cartridge ram and registers can have side effects or banking, read them byte by byte
+	return NULL;
+}
+
+void cpu_set_bus_locked (bool locked) {
+	cpu.bus_locked = locked;
+	bus_trapped    = cpu.bus_locked || bus_watched;
+	block_current  = NULL;
+}
+
+void cpu_breakpoints_changed (void) {
+	break_active = breakpoint_any();
+	// decoded blocks carry the trap handlers, they have to be decoded again
+	cpu_invalidate_blocks();
+}
+
+void cpu_set_watched (bool watched) {
+	bus_watched = watched;
+	bus_trapped = cpu.bus_locked || bus_watched;
 }
 
 int cpu_step (void) {
 	int cycles = 0;
 
 	if (!cpu.stop) {
-		cycles = cpu_step_real();
+		if (!cpu.halted) {
+			cycles = cpu_step_real();
+		}
+		else {
+			// clocks keep running while halted, wake up is checked below
+			cycles = 4;
+			stats.halted_cycles += cycles;
+		}
 
-		handle_interrupts();
+		if (cpu.int_pending) {
+			handle_interrupts();
+		}
 	}
 
+	cpu.cycles   += cycles;
+	stats.cycles += cycles;
+	while (cpu.cycles >= profiler_next_sample) {
+		profiler_sample(cpu_location(cpu.pc));
+		profiler_next_sample += PROFILER_INTERVAL;
+	}
 	return cycles;
 }
 
+uint64_t cpu_get_cycles (void) {
+	return cpu.cycles;
+}
+
 static int cpu_step_real (void) {
-	uint8_t instr  = read_byte(cpu.pc++);
-	int     cycles = cycles_main_opcodes[instr];
-	instructions[instr](&cycles);
+	const micro_op *op     = cpu_fetch_op();
+	int            cycles = op->cycles;
+
+	// translated blocks only fire it for their first op
+	PROBE3(instruction, op->pc, op->opcode, cpu.cycles);
+
+	if (trace_enabled) {
+		cpu_trace(op);
+	}
+
+	// only a fresh lookup hands out op 0, so this is the entry of a whole block
+	if (block_current != NULL && block_next_op == 1 && block_current->native != NULL) {
+		return cpu_run_native(block_current);
+	}
+
+	if (fuse_recording) {
+		cpu_fuse_count(op);
+	}
+
+	cpu_coverage_mark(op);
+	stats.instructions += op->instructions;
+	cpu.pc   = op->pc + op->len;
+	cpu.imm  = op->imm;
+	cpu.imm2 = op->imm2;
+	op->handler(&cycles);
+	PROFILE_OP(op, cycles);
 	return cycles;
 }
 
 void cpu_request_interrupt (int bit) {
+	PROBE1(interrupt_request, bit);
 	cpu.interrupt_flag |= (1 << bit) | 0xE0;
+	cpu_update_interrupts();
 }
 
 
@@ -708,8 +2122,7 @@ static void cpu_instr_0x00(int *cycles) {
 
 static void cpu_instr_0x01(int *cycles) {
 	// LD BC, d16
-	cpu.bc = read_word(cpu.pc);
-	cpu.pc += 2;
+	cpu.bc = IMM16;
 }
 
 static void cpu_instr_0x02(int *cycles) {
@@ -736,8 +2149,7 @@ static void cpu_instr_0x05(int *cycles) {
 
 static void cpu_instr_0x06(int *cycles) {
 	// LD B, d8
-	cpu.b = read_byte(cpu.pc);
-	cpu.pc++;
+	cpu.b = IMM8;
 }
 
 static void cpu_instr_0x07(int *cycles) {
@@ -747,8 +2159,7 @@ static void cpu_instr_0x07(int *cycles) {
 
 static void cpu_instr_0x08(int *cycles) {
 	// LD (a16), SP
-	write_word(read_word(cpu.pc), cpu.sp);
-	cpu.pc += 2;
+	write_word(IMM16, cpu.sp);
 }
 
 static void cpu_instr_0x09(int *cycles) {
@@ -780,8 +2191,7 @@ static void cpu_instr_0x0d(int *cycles) {
 
 static void cpu_instr_0x0e(int *cycles) {
 	// LD C, d8
-	cpu.c = read_byte(cpu.pc);
-	cpu.pc++;
+	cpu.c = IMM8;
 }
 
 static void cpu_instr_0x0f(int *cycles) {
@@ -796,8 +2206,7 @@ static void cpu_instr_0x10(int *cycles) {
 
 static void cpu_instr_0x11(int *cycles) {
 	// LD DE, d16
-	cpu.de = read_word(cpu.pc);
-	cpu.pc += 2;
+	cpu.de = IMM16;
 }
 
 static void cpu_instr_0x12(int *cycles) {
@@ -824,8 +2233,7 @@ static void cpu_instr_0x15(int *cycles) {
 
 static void cpu_instr_0x16(int *cycles) {
 	// LD D, d8
-	cpu.d = read_byte(cpu.pc);
-	cpu.pc++;
+	cpu.d = IMM8;
 }
 
 static void cpu_instr_0x17(int *cycles) {
@@ -835,7 +2243,7 @@ static void cpu_instr_0x17(int *cycles) {
 
 static void cpu_instr_0x18(int *cycles) {
 	// JR r8
-	cpu.pc = (int16_t) cpu.pc + (int8_t) read_byte(cpu.pc) + 1;
+	cpu.pc = cpu.pc + (int8_t) IMM8;
 }
 
 static void cpu_instr_0x19(int *cycles) {
@@ -867,8 +2275,7 @@ static void cpu_instr_0x1d(int *cycles) {
 
 static void cpu_instr_0x1e(int *cycles) {
 	// LD E, d8
-	cpu.e = read_byte(cpu.pc);
-	cpu.pc++;
+	cpu.e = IMM8;
 }
 
 static void cpu_instr_0x1f(int *cycles) {
@@ -879,18 +2286,14 @@ static void cpu_instr_0x1f(int *cycles) {
 static void cpu_instr_0x20(int *cycles) {
 	// JR NZ, r8
 	if (!GET_FLAG(Z)) {
-		cpu.pc = (int16_t) cpu.pc + (int8_t) read_byte(cpu.pc) + 1;
+		cpu.pc = cpu.pc + (int8_t) IMM8;
 		*cycles += 4;
 	}
-	else {
-		cpu.pc++;
-	}
 }
 
 static void cpu_instr_0x21(int *cycles) {
 	// LD HL, d16
-	cpu.hl = read_word(cpu.pc);
-	cpu.pc += 2;
+	cpu.hl = IMM16;
 }
 
 static void cpu_instr_0x22(int *cycles) {
@@ -917,8 +2320,7 @@ static void cpu_instr_0x25(int *cycles) {
 
 static void cpu_instr_0x26(int *cycles) {
 	// LD H, d8
-	cpu.h = read_byte(cpu.pc);
-	cpu.pc++;
+	cpu.h = IMM8;
 }
 
 static void cpu_instr_0x27(int *cycles) {
@@ -929,12 +2331,9 @@ static void cpu_instr_0x27(int *cycles) {
 static void cpu_instr_0x28(int *cycles) {
 	// JR Z, r8
 	if (GET_FLAG(Z)) {
-		cpu.pc = (int16_t) cpu.pc + (int8_t) read_byte(cpu.pc) + 1;
+		cpu.pc = cpu.pc + (int8_t) IMM8;
 		*cycles += 4;
 	}
-	else {
-		cpu.pc++;
-	}
 }
 
 static void cpu_instr_0x29(int *cycles) {
@@ -966,8 +2365,7 @@ static void cpu_instr_0x2d(int *cycles) {
 
 static void cpu_instr_0x2e(int *cycles) {
 	// LD L, d8
-	cpu.l = read_byte(cpu.pc);
-	cpu.pc++;
+	cpu.l = IMM8;
 }
 
 static void cpu_instr_0x2f(int *cycles) {
@@ -978,18 +2376,14 @@ static void cpu_instr_0x2f(int *cycles) {
 static void cpu_instr_0x30(int *cycles) {
 	// JR NC, r8
 	if (!GET_FLAG(C)) {
-		cpu.pc = (int16_t) cpu.pc + (int8_t) read_byte(cpu.pc) + 1;
+		cpu.pc = cpu.pc + (int8_t) IMM8;
 		*cycles += 4;
 	}
-	else {
-		cpu.pc++;
-	}
 }
 
 static void cpu_instr_0x31(int *cycles) {
 	// LD SP, d16
-	cpu.sp = read_word(cpu.pc);
-	cpu.pc += 2;
+	cpu.sp = IMM16;
 }
 
 static void cpu_instr_0x32(int *cycles) {
@@ -1016,8 +2410,7 @@ static void cpu_instr_0x35(int *cycles) {
 
 static void cpu_instr_0x36(int *cycles) {
 	// LD (HL), d8
-	write_byte(cpu.hl, read_byte(cpu.pc));
-	cpu.pc++;
+	write_byte(cpu.hl, IMM8);
 }
 
 static void cpu_instr_0x37(int *cycles) {
@@ -1028,12 +2421,9 @@ static void cpu_instr_0x37(int *cycles) {
 static void cpu_instr_0x38(int *cycles) {
 	// JR C, r8
 	if (GET_FLAG(C)) {
-		cpu.pc = (int16_t) cpu.pc + (int8_t) read_byte(cpu.pc) + 1;
+		cpu.pc = cpu.pc + (int8_t) IMM8;
 		*cycles += 4;
 	}
-	else {
-		cpu.pc++;
-	}
 }
 
 static void cpu_instr_0x39(int *cycles) {
@@ -1065,8 +2455,7 @@ static void cpu_instr_0x3d(int *cycles) {
 
 static void cpu_instr_0x3e(int *cycles) {
 	// LD A, d8
-	cpu.a = read_byte(cpu.pc);
-	cpu.pc++;
+	cpu.a = IMM8;
 }
 
 static void cpu_instr_0x3f(int *cycles) {
@@ -1346,6 +2735,8 @@ static void cpu_instr_0x75(int *cycles) {
 
 static void cpu_instr_0x76(int *cycles) {
 	// HALT
+	cpu.halted = true;
+	cpu_update_interrupts();
 }
 
 static void cpu_instr_0x77(int *cycles) {
@@ -1741,6 +3132,7 @@ static void cpu_instr_0xc0(int *cycles) {
 	// RET NZ
 	if (!GET_FLAG(Z)) {
 		cpu.pc = stack_pop();
+		cpu_profiler_return();
 	}
 }
 
@@ -1752,29 +3144,24 @@ static void cpu_instr_0xc1(int *cycles) {
 static void cpu_instr_0xc2(int *cycles) {
 	// JP NZ, a16
 	if (!GET_FLAG(Z)) {
-		cpu.pc = read_word(cpu.pc);
+		cpu.pc = IMM16;
 		*cycles += 4;
 	}
-	else {
-		cpu.pc += 2;
-	}
 }
 
 static void cpu_instr_0xc3(int *cycles) {
 	// JP a16
-	cpu.pc = read_word(cpu.pc);
+	cpu.pc = IMM16;
 }
 
 static void cpu_instr_0xc4(int *cycles) {
 	// CALL NZ, a16
 	if (!GET_FLAG(Z)) {
-		stack_push(cpu.pc + 2);
-		cpu.pc = read_word(cpu.pc);
+		stack_push(cpu.pc);
+		cpu.pc = IMM16;
+		cpu_profiler_call();
 		*cycles += 12;
 	}
-	else {
-		cpu.pc += 2;
-	}
 }
 
 static void cpu_instr_0xc5(int *cycles) {
@@ -1796,23 +3183,22 @@ static void cpu_instr_0xc8(int *cycles) {
 	// RET Z
 	if (GET_FLAG(Z)) {
 		cpu.pc = stack_pop();
+		cpu_profiler_return();
 	}
 }
 
 static void cpu_instr_0xc9(int *cycles) {
 	// RET
 	cpu.pc = stack_pop();
+	cpu_profiler_return();
 }
 
 static void cpu_instr_0xca(int *cycles) {
 	// JP Z, a16
 	if (GET_FLAG(Z)) {
-		cpu.pc = read_word(cpu.pc);
+		cpu.pc = IMM16;
 		*cycles += 4;
 	}
-	else {
-		cpu.pc += 2;
-	}
 }
 
 static void cpu_instr_0xcb(int *cycles) {
@@ -1823,19 +3209,18 @@ static void cpu_instr_0xcb(int *cycles) {
 static void cpu_instr_0xcc(int *cycles) {
 	// CALL Z, a16
 	if (GET_FLAG(Z)) {
-		stack_push(cpu.pc + 2);
-		cpu.pc = read_word(cpu.pc);
+		stack_push(cpu.pc);
+		cpu.pc = IMM16;
+		cpu_profiler_call();
 		*cycles += 12;
 	}
-	else {
-		cpu.pc += 2;
-	}
 }
 
 static void cpu_instr_0xcd(int *cycles) {
 	// CALL a16
-	stack_push(cpu.pc + 2);
-	cpu.pc = read_word(cpu.pc);
+	stack_push(cpu.pc);
+	cpu.pc = IMM16;
+	cpu_profiler_call();
 }
 
 static void cpu_instr_0xce(int *cycles) {
@@ -1852,6 +3237,7 @@ static void cpu_instr_0xd0(int *cycles) {
 	// RET NC
 	if (!GET_FLAG(C)) {
 		cpu.pc = stack_pop();
+		cpu_profiler_return();
 	}
 }
 
@@ -1863,12 +3249,9 @@ static void cpu_instr_0xd1(int *cycles) {
 static void cpu_instr_0xd2(int *cycles) {
 	// JP NC, a16
 	if (!GET_FLAG(C)) {
-		cpu.pc = read_word(cpu.pc);
+		cpu.pc = IMM16;
 		*cycles += 4;
 	}
-	else {
-		cpu.pc += 2;
-	}
 }
 
 static void cpu_instr_0xd3(int *cycles) {
@@ -1879,13 +3262,11 @@ static void cpu_instr_0xd3(int *cycles) {
 static void cpu_instr_0xd4(int *cycles) {
 	// CALL NC, a16
 	if (!GET_FLAG(C)) {
-		stack_push(cpu.pc + 2);
-		cpu.pc = read_word(cpu.pc);
+		stack_push(cpu.pc);
+		cpu.pc = IMM16;
+		cpu_profiler_call();
 		*cycles += 12;
 	}
-	else {
-		cpu.pc += 2;
-	}
 }
 
 static void cpu_instr_0xd5(int *cycles) {
@@ -1907,24 +3288,24 @@ static void cpu_instr_0xd8(int *cycles) {
 	// RET C
 	if (GET_FLAG(C)) {
 		cpu.pc = stack_pop();
+		cpu_profiler_return();
 	}
 }
 
 static void cpu_instr_0xd9(int *cycles) {
 	// RETI
 	cpu.pc  = stack_pop();
+	cpu_profiler_return();
 	cpu.ime = 1;
+	cpu_update_interrupts();
 }
 
 static void cpu_instr_0xda(int *cycles) {
 	// JP C, a16
 	if (GET_FLAG(C)) {
-		cpu.pc = read_word(cpu.pc);
+		cpu.pc = IMM16;
 		*cycles += 4;
 	}
-	else {
-		cpu.pc += 2;
-	}
 }
 
 static void cpu_instr_0xdb(int *cycles) {
@@ -1935,13 +3316,11 @@ static void cpu_instr_0xdb(int *cycles) {
 static void cpu_instr_0xdc(int *cycles) {
 	// CALL C, a16
 	if (GET_FLAG(C)) {
-		stack_push(cpu.pc + 2);
-		cpu.pc = read_word(cpu.pc);
+		stack_push(cpu.pc);
+		cpu.pc = IMM16;
+		cpu_profiler_call();
 		*cycles += 12;
 	}
-	else {
-		cpu.pc += 2;
-	}
 }
 
 static void cpu_instr_0xdd(int *cycles) {
@@ -1961,7 +3340,7 @@ static void cpu_instr_0xdf(int *cycles) {
 
 static void cpu_instr_0xe0(int *cycles) {
 	// LDH (a8), A
-	write_byte(0xFF00 + read_byte(cpu.pc++), cpu.a);
+	write_byte(0xFF00 + IMM8, cpu.a);
 }
 
 static void cpu_instr_0xe1(int *cycles) {
@@ -1991,7 +3370,7 @@ static void cpu_instr_0xe5(int *cycles) {
 
 static void cpu_instr_0xe6(int *cycles) {
 	// AND d8
-	cpu.a &= read_byte(cpu.pc++);
+	cpu.a &= IMM8;
 	SET_AND_FLAGS();
 }
 
@@ -2002,7 +3381,7 @@ static void cpu_instr_0xe7(int *cycles) {
 
 static void cpu_instr_0xe8(int *cycles) {
 	// ADD SP, r8
-	cpu_opcode_add_sp((int8_t) read_byte(cpu.pc++));
+	cpu_opcode_add_sp((int8_t) IMM8);
 }
 
 static void cpu_instr_0xe9(int *cycles) {
@@ -2012,8 +3391,7 @@ static void cpu_instr_0xe9(int *cycles) {
 
 static void cpu_instr_0xea(int *cycles) {
 	// LD (a16), A
-	write_byte(read_word(cpu.pc), cpu.a);
-	cpu.pc += 2;
+	write_byte(IMM16, cpu.a);
 }
 
 static void cpu_instr_0xeb(int *cycles) {
@@ -2033,9 +3411,8 @@ static void cpu_instr_0xed(int *cycles) {
 
 static void cpu_instr_0xee(int *cycles) {
 	// XOR d8
-	cpu.a ^= read_byte(cpu.pc);
+	cpu.a ^= IMM8;
 	SET_xOR_FLAGS();
-	cpu.pc++;
 }
 
 static void cpu_instr_0xef(int *cycles) {
@@ -2045,14 +3422,14 @@ static void cpu_instr_0xef(int *cycles) {
 
 static void cpu_instr_0xf0(int *cycles) {
 	// LDH A, (a8)
-	cpu.a = read_byte(read_byte(cpu.pc) + 0xFF00);
-	cpu.pc++;
+	cpu.a = read_byte(IMM8 + 0xFF00);
 }
 
 static void cpu_instr_0xf1(int *cycles) {
 	// POP AF
 	cpu.af = stack_pop();
 	cpu.f &= ~0xF;
+	cpu.flags_op = FLAGS_NONE;
 }
 
 static void cpu_instr_0xf2(int *cycles) {
@@ -2062,7 +3439,9 @@ static void cpu_instr_0xf2(int *cycles) {
 
 static void cpu_instr_0xf3(int *cycles) {
 	// DI
-	cpu.ime = 0;
+	cpu.ime       = 0;
+	cpu.ime_delay = 0;
+	cpu_update_interrupts();
 }
 
 static void cpu_instr_0xf4(int *cycles) {
@@ -2072,14 +3451,14 @@ static void cpu_instr_0xf4(int *cycles) {
 
 static void cpu_instr_0xf5(int *cycles) {
 	// PUSH AF
+	cpu_flags_sync();
 	stack_push(cpu.af);
 }
 
 static void cpu_instr_0xf6(int *cycles) {
 	// OR d8
-	cpu.a |= read_byte(cpu.pc);
+	cpu.a |= IMM8;
 	SET_xOR_FLAGS();
-	cpu.pc++;
 }
 
 static void cpu_instr_0xf7(int *cycles) {
@@ -2089,7 +3468,7 @@ static void cpu_instr_0xf7(int *cycles) {
 
 static void cpu_instr_0xf8(int *cycles) {
 	// LD HL, SP+r8
-	cpu_opcode_ld_hl_sp((int8_t) read_byte(cpu.pc++));
+	cpu_opcode_ld_hl_sp((int8_t) IMM8);
 }
 
 static void cpu_instr_0xf9(int *cycles) {
@@ -2099,13 +3478,13 @@ static void cpu_instr_0xf9(int *cycles) {
 
 static void cpu_instr_0xfa(int *cycles) {
 	// LD A, (a16)
-	cpu.a = read_byte(read_word(cpu.pc));
-	cpu.pc += 2;
+	cpu.a = read_byte(IMM16);
 }
 
 static void cpu_instr_0xfb(int *cycles) {
 	// EI
-	cpu.ime = 1;
+	cpu.ime_delay = 2;
+	cpu_update_interrupts();
 }
 
 static void cpu_instr_0xfc(int *cycles) {
@@ -2128,7 +3507,7 @@ static void cpu_instr_0xff(int *cycles) {
 	cpu_opcode_rst(0x38);
 }
 
-static inline ALWAYS_INLINE uint8_t read_byte(uint16_t addr) {
+static inline ALWAYS_INLINE uint8_t read_byte_bus(uint16_t addr) {
 	uint8_t val = 0;
 	if (addr >= 0 && addr <= 0x7FFF) {
 		val = rom_read(addr);
@@ -2155,7 +3534,7 @@ static inline ALWAYS_INLINE uint8_t read_byte(uint16_t addr) {
 		// unusable memory
 	}
 	else if (addr >= 0xFF00 && addr <= 0xFF7F) {
-		val = cpu_read_register(addr);
+		val = io_read(addr);
 	}
 	else if (addr >= 0xFF80 && addr <= 0xFFFE) {
 		val = zeropage[addr%0xFF80];
@@ -2166,37 +3545,114 @@ static inline ALWAYS_INLINE uint8_t read_byte(uint16_t addr) {
 	return val;
 }
 
-static inline ALWAYS_INLINE void write_byte(uint16_t addr, uint8_t val) {
+static inline ALWAYS_INLINE void write_byte_bus(uint16_t addr, uint8_t val) {
 	if (addr >= 0 && addr <= 0x7FFF) {
 		rom_write(addr, val);
+		// bank may have changed under the running block
+		block_current = NULL;
 	}
 	else if (addr >= 0x8000 && addr <= 0x9FFF) {
 		gpu_write(addr%0x8000, val);
+		stats.vram_writes++;
 	}
 	else if (addr >= 0xA000 && addr <= 0xBFFF) {
 		rom_write(addr, val);
 	}
 	else if (addr >= 0xC000 && addr <= 0xF0FF) {
 		iram[addr%0xC000] = val;
+		if (iram_code[addr%0xC000]) {
+			cpu_invalidate_ram_blocks();
+		}
 	}
 	else if (addr >= 0xE000 && addr <= 0xFDFF) {
 		iram[addr%0xE000] = val;
+		if (iram_code[addr%0xE000]) {
+			cpu_invalidate_ram_blocks();
+		}
 	}
 	else if (addr >= 0xFE00 && addr <= 0xFE9F) {
 		gpu_oam_write(addr % 0xFE00, val);
+		stats.oam_writes++;
 	}
 	else if (addr >= 0xFEA0 && addr <= 0xFEFF) {
 		// unusable memory
 	}
 	else if (addr >= 0xFF00 && addr <= 0xFF7F) {
-		cpu_write_register(addr, val);
+		io_write(addr, val);
 	}
 	else if (addr >= 0xFF80 && addr <= 0xFFFE) {
 		zeropage[addr%0xFF80] = val;
+		if (zeropage_code[addr%0xFF80]) {
+			cpu_invalidate_ram_blocks();
+		}
 	}
 	else {
 		cpu.interrupt_enable = val;
+		cpu_update_interrupts();
+	}
+}
+
+// op running right now, translated blocks only know their first one
+static const micro_op *cpu_op_current (void) {
+	if (block_current != NULL && block_next_op > 0) {
+		return &block_current->ops[block_next_op - 1];
 	}
+	return &block_uncached;
+}
+
+static uint16_t cpu_op_pc (void) {
+	return cpu_op_current()->pc;
+}
+
+uint8_t cpu_peek (uint16_t addr) {
+	return read_byte_bus(addr);
+}
+
+static uint8_t read_byte_trapped (uint16_t addr) {
+	if (cpu.bus_locked && addr < 0xFF80) {
+		return 0xFF;
+	}
+
+	uint8_t val = read_byte_bus(addr);
+	if (watch_pages()[addr >> 8] & WATCH_READ) {
+		uint16_t pc = cpu_op_pc();
+
+		watch_read(addr, val, pc, cpu_location(pc));
+	}
+	return val;
+}
+
+static void write_byte_trapped (uint16_t addr, uint8_t val) {
+	if (cpu.bus_locked && addr < 0xFF80) {
+		return;
+	}
+
+	if (watch_pages()[addr >> 8] & (WATCH_WRITE | WATCH_CHANGE)) {
+		// the write can drop block_current and switch banks, so pc and its location are taken before it
+		uint16_t pc        = cpu_op_pc();
+		uint32_t location  = cpu_location(pc);
+		uint8_t  old_value = read_byte_bus(addr);
+
+		write_byte_bus(addr, val);
+		watch_write(addr, old_value, val, pc, location);
+		return;
+	}
+	write_byte_bus(addr, val);
+}
+
+static inline ALWAYS_INLINE uint8_t read_byte(uint16_t addr) {
+	if (__builtin_expect(bus_trapped, 0)) {
+		return read_byte_trapped(addr);
+	}
+	return read_byte_bus(addr);
+}
+
+static inline ALWAYS_INLINE void write_byte(uint16_t addr, uint8_t val) {
+	if (__builtin_expect(bus_trapped, 0)) {
+		write_byte_trapped(addr, val);
+		return;
+	}
+	write_byte_bus(addr, val);
 }
 
 static inline ALWAYS_INLINE uint16_t read_word(uint16_t addr) {
@@ -2245,6 +3701,7 @@ static void cpu_print_mem (uint16_t begin, uint16_t end) {
 }
 
 static void cpu_dump_state () {
+	cpu_flags_sync();
 	println("Current INSTRUCTION POS: 0x%04x", cpu.pc - 1);
 	println("Current INSTRUCTION is 0x%02x", read_byte(cpu.pc - 1));
 	println("CPU:\n Flags:\tZ:%d N:%d H:%d C:%d", GET_FLAG(Z), GET_FLAG(N), GET_FLAG(H), GET_FLAG(C));
@@ -2253,234 +3710,22 @@ static void cpu_dump_state () {
 	        , cpu.b, cpu.c, cpu.d, cpu.e, cpu.h, cpu.l, cpu.f);
 }
 
-static uint8_t cpu_read_register (uint16_t addr) {
-	switch (addr) {
-	case 0xFF0F:
-		return cpu.interrupt_flag;
-
-	case 0xFF40:
-	case 0xFF41:
-	case 0xFF42:
-	case 0xFF43:
-	case 0xFF44:
-	case 0xFF45:
-	case 0xFF46:
-	case 0xFF47:
-	case 0xFF48:
-	case 0xFF49:
-	case 0xFF4A:
-	case 0xFF4B:
-		return gpu_read_reg(addr);
-
-	case 0xFF50:
-		return cpu.boot_rom_enabled ? 1 : 0;
-
-	case 0xFF00:
-		return joypad_read_reg();
-
-	case 0xFF01:
-		return serial_read();
-
-	case 0xFF02:
-		return 0xff;
-
-	case 0xFF03:
-		return 0xff;
-
-	case 0xFF04:
-	case 0xFF05:
-	case 0xFF06:
-	case 0xFF07:
-		return timer_read_reg(addr);
-
-	default:
-		return 0x00;
-	}
-}
-
-static void cpu_write_register(uint16_t addr, uint8_t val) {
-	switch(addr) {
-	case 0xFF0F:
-		cpu.interrupt_flag = val | 0xE0;
-		break;
-
-	case 0xFF40:
-	case 0xFF41:
-	case 0xFF42:
-	case 0xFF43:
-	case 0xFF44:
-	case 0xFF45:
-	case 0xFF46:
-	case 0xFF47:
-	case 0xFF48:
-	case 0xFF49:
-	case 0xFF4A:
-	case 0xFF4B:
-		gpu_write_reg(addr, val);
-		break;
-
-	case 0xFF50:
-		if (val == 0x1) {
-			println("Disabling boot rom!");
-			cpu.boot_rom_enabled = 0;
-		}
-		break;
-
-	case 0xFF00:
-		joypad_write_reg(val);
-		break;
-
-	case 0xFF01:
-		serial_write(val);
-		break;
-
-	case 0xFF02:
-		serial_write_control(val);
-		break;
-
-	case 0xFF04:
-	case 0xFF05:
-	case 0xFF06:
-	case 0xFF07:
-		timer_write_reg(addr, val);
-		break;
-
-	default:
-		break;
-	}
-}
-
-static enum registers map_register(uint8_t opcode) {
-	enum registers reg_code = (opcode & 0xF)%8;
-	return reg_code;
-}
-
-static void cpu_opcode_bit(enum registers reg, uint8_t bit) {
-	switch (reg) {
-	case REG_B:
-		SET_BIT_FLAGS(bit, cpu.b);
-		break;
-	case REG_C:
-		SET_BIT_FLAGS(bit, cpu.c);
-		break;
-	case REG_D:
-		SET_BIT_FLAGS(bit, cpu.d);
-		break;
-	case REG_E:
-		SET_BIT_FLAGS(bit, cpu.e);
-		break;
-	case REG_H:
-		SET_BIT_FLAGS(bit, cpu.h);
-		break;
-	case REG_L:
-		SET_BIT_FLAGS(bit, cpu.l);
-		break;
-	case REG_HL:
-		SET_BIT_FLAGS(bit, read_byte(cpu.hl));
-		break;
-	case REG_A:
-		SET_BIT_FLAGS(bit, cpu.a);
-		break;
-
-	}
+static inline void cpu_opcode_bit (uint8_t value, uint8_t bit) {
+	SET_BIT_FLAGS(bit, value);
 }
 
-static inline void cpu_opcode_set(enum registers reg, uint8_t bit) {
-	switch (reg) {
-	case REG_B:
-		cpu.b |= (1<<bit);
-		break;
-	case REG_C:
-		cpu.c |= (1<<bit);
-		break;
-	case REG_D:
-		cpu.d |= (1<<bit);
-		break;
-	case REG_E:
-		cpu.e |= (1<<bit);
-		break;
-	case REG_H:
-		cpu.h |= (1<<bit);
-		break;
-	case REG_L:
-		cpu.l |= (1<<bit);
-		break;
-	case REG_HL:
-		write_byte(cpu.hl, read_byte(cpu.hl) | (1<<bit));
-		break;
-	case REG_A:
-		cpu.a |= (1<<bit);
-		break;
-
-	}
+static inline uint8_t cpu_opcode_set (uint8_t value, uint8_t bit) {
+	return value | (1<<bit);
 }
 
-static inline void cpu_opcode_res(enum registers reg, uint8_t bit) {
-	switch (reg) {
-	case REG_B:
-		cpu.b &= ~(1<<bit);
-		break;
-	case REG_C:
-		cpu.c &= ~(1<<bit);
-		break;
-	case REG_D:
-		cpu.d &= ~(1<<bit);
-		break;
-	case REG_E:
-		cpu.e &= ~(1<<bit);
-		break;
-	case REG_H:
-		cpu.h &= ~(1<<bit);
-		break;
-	case REG_L:
-		cpu.l &= ~(1<<bit);
-		break;
-	case REG_HL:
-		write_byte(cpu.hl, read_byte(cpu.hl) & ~(1<<bit));
-		break;
-	case REG_A:
-		cpu.a &= ~(1<<bit);
-		break;
-
-	}
+static inline uint8_t cpu_opcode_res (uint8_t value, uint8_t bit) {
+	return value & ~(1<<bit);
 }
 
-static inline void cpu_opcode_swap(enum registers reg) {
-	switch (reg) {
-	case REG_B:
-		cpu.b = ((cpu.b & 0x0F)<<4 | (cpu.b & 0xF0)>>4);
-		SET_SWAP_FLAGS(cpu.b);
-		break;
-	case REG_C:
-		cpu.c = ((cpu.c & 0x0F)<<4 | (cpu.c & 0xF0)>>4);
-		SET_SWAP_FLAGS(cpu.c);
-		break;
-	case REG_D:
-		cpu.d = ((cpu.d & 0x0F)<<4 | (cpu.d & 0xF0)>>4);
-		SET_SWAP_FLAGS(cpu.d);
-		break;
-	case REG_E:
-		cpu.e = ((cpu.e & 0x0F)<<4 | (cpu.e & 0xF0)>>4);
-		SET_SWAP_FLAGS(cpu.e);
-		break;
-	case REG_H:
-		cpu.h = ((cpu.h & 0x0F)<<4 | (cpu.h & 0xF0)>>4);
-		SET_SWAP_FLAGS(cpu.h);
-		break;
-	case REG_L:
-		cpu.l = ((cpu.l & 0x0F)<<4 | (cpu.l & 0xF0)>>4);
-		SET_SWAP_FLAGS(cpu.l);
-		break;
-	case REG_HL:
-		write_byte(cpu.hl, (read_byte(cpu.hl) & 0x0F)<<4 | (read_byte(cpu.hl) & 0xF0)>>4);
-		SET_SWAP_FLAGS(read_byte(cpu.hl));
-		break;
-	case REG_A:
-		cpu.a = ((cpu.a & 0x0F)<<4 | (cpu.a & 0xF0)>>4);
-		SET_SWAP_FLAGS(cpu.a);
-		break;
-
-	}
+static inline uint8_t cpu_opcode_swap (uint8_t value) {
+	value = (value & 0x0F)<<4 | (value & 0xF0)>>4;
+	SET_SWAP_FLAGS(value);
+	return value;
 }
 
 // move instr impl here
@@ -2488,12 +3733,15 @@ static inline void cpu_opcode_swap(enum registers reg) {
 static inline void cpu_opcode_rst (const uint8_t offset) {
 	stack_push(cpu.pc);
 	cpu.pc = 0x0000 + offset;
+	cpu_profiler_call();
 }
 
 static inline void cpu_opcode_interrupt (const uint8_t offset) {
 	stack_push(cpu.pc);
-	cpu.pc  = 0x0000 + offset;
-	cpu.ime = 0;
+	cpu.pc        = 0x0000 + offset;
+	cpu.ime       = 0;
+	cpu.ime_delay = 0;
+	cpu_profiler_call();
 }
 
 /* this function only rotate data */
@@ -2502,7 +3750,7 @@ static inline uint8_t cpu_opcode_rl (uint8_t data) {
 	bool new_flag = data & 0x80;
 	data <<= 1;
 	data |= (!!c_flag<<0);
-	cpu.f = SET_FLAGS(data == 0, 0, 0, new_flag);
+	cpu_set_flags(data == 0, 0, 0, new_flag);
 	return data;
 }
 
@@ -2511,7 +3759,7 @@ static inline void cpu_opcode_rla() {
 	bool new_flag = cpu.a & 0x80;
 	cpu.a <<= 1;
 	cpu.a |= (!!c_flag<<0);
-	cpu.f         = SET_FLAGS(0, 0, 0, new_flag);
+	cpu_set_flags(0, 0, 0, new_flag);
 }
 
 /* this function only rotate data */
@@ -2520,7 +3768,7 @@ static inline uint8_t cpu_opcode_rr(uint8_t data) {
 	bool new_flag = data & 0x01;
 	data >>= 1;
 	data |= (!!c_flag<<7);
-	cpu.f = SET_FLAGS(data == 0, 0, 0, new_flag);
+	cpu_set_flags(data == 0, 0, 0, new_flag);
 	return data;
 }
 
@@ -2529,14 +3777,14 @@ static inline void cpu_opcode_rra() {
 	bool new_flag = cpu.a & 0x01;
 	cpu.a >>= 1;
 	cpu.a |= (c_flag<<7);
-	cpu.f         = SET_FLAGS(0, 0, 0, new_flag);
+	cpu_set_flags(0, 0, 0, new_flag);
 }
 
 static inline uint8_t cpu_opcode_rlc(uint8_t value) {
 	bool new_flag = value & 0x80;
 	value <<= 1;
 	value |= !!new_flag;
-	cpu.f = SET_FLAGS(value == 0, 0, 0, new_flag);
+	cpu_set_flags(value == 0, 0, 0, new_flag);
 	return value;
 }
 
@@ -2544,7 +3792,7 @@ static inline uint8_t cpu_opcode_rrc(uint8_t value) {
 	bool new_flag = value & 0x01;
 	value >>= 1;
 	value |= (!!new_flag<<7);
-	cpu.f = SET_FLAGS(value == 0, 0, 0, new_flag);
+	cpu_set_flags(value == 0, 0, 0, new_flag);
 	return value;
 }
 
@@ -2552,20 +3800,20 @@ static inline void cpu_opcode_rlca () {
 	bool new_flag = cpu.a & 0x80;
 	cpu.a <<= 1;
 	cpu.a |= !!new_flag;
-	cpu.f         = SET_FLAGS(0, 0, 0, new_flag);
+	cpu_set_flags(0, 0, 0, new_flag);
 }
 
 static inline uint8_t cpu_opcode_sla (uint8_t value) {
 	bool new_flag = value & 0x80;
 	value <<= 1;
-	cpu.f = SET_FLAGS(value == 0, 0, 0, new_flag);
+	cpu_set_flags(value == 0, 0, 0, new_flag);
 	return value;
 }
 
 static inline uint8_t cpu_opcode_srl (uint8_t value) {
 	bool new_flag = value & 0x01;
 	value >>= 1;
-	cpu.f = SET_FLAGS(value == 0, 0, 0, new_flag);
+	cpu_set_flags(value == 0, 0, 0, new_flag);
 	return value;
 }
 
@@ -2574,7 +3822,7 @@ static inline uint8_t cpu_opcode_sra (uint8_t value) {
 	bool hi_flag = value & 0x80;
 	value >>= 1;
 	value |= (hi_flag<<7);
-	cpu.f = SET_FLAGS(value == 0, 0, 0, lo_flag);
+	cpu_set_flags(value == 0, 0, 0, lo_flag);
 	return value;
 }
 
@@ -2582,320 +3830,181 @@ static inline void cpu_opcode_rrca () {
 	bool new_flag = cpu.a & 0x01;
 	cpu.a >>= 1;
 	cpu.a |= (!!new_flag<<7);
-	cpu.f         = SET_FLAGS(0, 0, 0, new_flag);
-}
-
-static inline void cpu_opcode_rl_full (enum registers reg) {
-	switch (reg) {
-	case REG_B:
-		cpu.b = cpu_opcode_rl(cpu.b);
-		break;
-	case REG_C:
-		cpu.c = cpu_opcode_rl(cpu.c);
-		break;
-	case REG_D:
-		cpu.d = cpu_opcode_rl(cpu.d);
-		break;
-	case REG_E:
-		cpu.e = cpu_opcode_rl(cpu.e);
-		break;
-	case REG_H:
-		cpu.h = cpu_opcode_rl(cpu.h);
-		break;
-	case REG_L:
-		cpu.l = cpu_opcode_rl(cpu.l);
-		break;
-	case REG_HL:
-		write_byte(cpu.hl, cpu_opcode_rl(read_byte(cpu.hl)));
-		break;
-	case REG_A:
-		cpu.a = cpu_opcode_rl(cpu.a);
-		break;
+	cpu_set_flags(0, 0, 0, new_flag);
+}
+
+/*
+ * CB prefixed opcodes, one handler per opcode generated below.
+ * Low three opcode bits pick the operand, CB_READ_x/CB_WRITE_x give
+ * direct access to it, so no handler decodes anything at run time.
+ */
+#define CB_OPERANDS(X, op, arg) \
+	X(op, arg, b, 0) X(op, arg, c, 1) X(op, arg, d, 2) X(op, arg, e, 3) \
+	X(op, arg, h, 4) X(op, arg, l, 5) X(op, arg, hl, 6) X(op, arg, a, 7)
+
+#define CB_READ_b  cpu.b
+#define CB_READ_c  cpu.c
+#define CB_READ_d  cpu.d
+#define CB_READ_e  cpu.e
+#define CB_READ_h  cpu.h
+#define CB_READ_l  cpu.l
+#define CB_READ_hl read_byte(cpu.hl)
+#define CB_READ_a  cpu.a
+
+#define CB_WRITE_b(val)  (cpu.b = (val))
+#define CB_WRITE_c(val)  (cpu.c = (val))
+#define CB_WRITE_d(val)  (cpu.d = (val))
+#define CB_WRITE_e(val)  (cpu.e = (val))
+#define CB_WRITE_h(val)  (cpu.h = (val))
+#define CB_WRITE_l(val)  (cpu.l = (val))
+#define CB_WRITE_hl(val) write_byte(cpu.hl, (val))
+#define CB_WRITE_a(val)  (cpu.a = (val))
+
+// 0x00-0x3F, X(op, base)
+#define CB_SHIFT_OPS(X) \
+	X(rlc, 0x00) X(rrc, 0x08) X(rl, 0x10) X(rr, 0x18) \
+	X(sla, 0x20) X(sra, 0x28) X(swap, 0x30) X(srl, 0x38)
+
+// 0x40-0xFF, X(op, bit), bases below
+#define CB_BIT_OPS(X, op) \
+	X(op, 0) X(op, 1) X(op, 2) X(op, 3) X(op, 4) X(op, 5) X(op, 6) X(op, 7)
+
+#define CB_BASE_bit 0x40
+#define CB_BASE_res 0x80
+#define CB_BASE_set 0xC0
+
+#define CB_SHIFT_HANDLER(op, base, reg, index) \
+	static void cpu_cb_##op##_##reg (int *cycles) { \
+		CB_WRITE_##reg(cpu_opcode_##op(CB_READ_##reg)); \
+	}
+#define CB_BIT_HANDLER(op, bit, reg, index) \
+	static void cpu_cb_##op##_##bit##_##reg (int *cycles) { \
+		cpu_opcode_bit(CB_READ_##reg, bit); \
+	}
+#define CB_RES_SET_HANDLER(op, bit, reg, index) \
+	static void cpu_cb_##op##_##bit##_##reg (int *cycles) { \
+		CB_WRITE_##reg(cpu_opcode_##op(CB_READ_##reg, bit)); \
 	}
+
+#define CB_SHIFT_HANDLERS(op, base)   CB_OPERANDS(CB_SHIFT_HANDLER, op, base)
+#define CB_BIT_HANDLERS(op, bit)      CB_OPERANDS(CB_BIT_HANDLER, op, bit)
+#define CB_RES_SET_HANDLERS(op, bit)  CB_OPERANDS(CB_RES_SET_HANDLER, op, bit)
+
+CB_SHIFT_OPS(CB_SHIFT_HANDLERS)
+CB_BIT_OPS(CB_BIT_HANDLERS, bit)
+CB_BIT_OPS(CB_RES_SET_HANDLERS, res)
+CB_BIT_OPS(CB_RES_SET_HANDLERS, set)
+
+#define CB_SHIFT_ENTRY(op, base, reg, index)  [(base) + (index)] = cpu_cb_##op##_##reg,
+#define CB_BIT_ENTRY(op, bit, reg, index)     [CB_BASE_##op + ((bit)<<3) + (index)] = cpu_cb_##op##_##bit##_##reg,
+
+#define CB_SHIFT_ENTRIES(op, base)  CB_OPERANDS(CB_SHIFT_ENTRY, op, base)
+#define CB_BIT_ENTRIES(op, bit)     CB_OPERANDS(CB_BIT_ENTRY, op, bit)
+
+static const instruction_handler cb_instructions[256] = {
+	CB_SHIFT_OPS(CB_SHIFT_ENTRIES)
+	CB_BIT_OPS(CB_BIT_ENTRIES, bit)
+	CB_BIT_OPS(CB_BIT_ENTRIES, res)
+	CB_BIT_OPS(CB_BIT_ENTRIES, set)
+};
+
+// stands in for the handler of ops at breakpoints, conditions see the registers before the op runs
+static void cpu_instr_break (int *cycles) {
+	const micro_op      *op      = cpu_op_current();
+	instruction_handler handler = (op->opcode == 0xCB) ? cb_instructions[op->imm] : instructions[op->opcode];
+
+	cpu_flags_sync();
+	breakpoint_state state = {cpu.af, cpu.bc, cpu.de, cpu.hl, cpu.sp, op->pc, cpu_location(op->pc)};
+	// the handler may remove breakpoints, that throws away the block op lives in
+	breakpoint_hit(&state);
+	handler(cycles);
 }
 
-static inline void cpu_opcode_rr_full(enum registers reg) {
-	switch (reg) {
-	case REG_B:
-		cpu.b = cpu_opcode_rr(cpu.b);
-		break;
-	case REG_C:
-		cpu.c = cpu_opcode_rr(cpu.c);
-		break;
-	case REG_D:
-		cpu.d = cpu_opcode_rr(cpu.d);
-		break;
-	case REG_E:
-		cpu.e = cpu_opcode_rr(cpu.e);
-		break;
-	case REG_H:
-		cpu.h = cpu_opcode_rr(cpu.h);
-		break;
-	case REG_L:
-		cpu.l = cpu_opcode_rr(cpu.l);
-		break;
-	case REG_HL:
-		write_byte(cpu.hl, cpu_opcode_rr(read_byte(cpu.hl)));
-		break;
-	case REG_A:
-		cpu.a = cpu_opcode_rr(cpu.a);
-		break;
+// fused handlers get the operand bytes of all their ops in order, in imm and imm2
+
+static void cpu_fused_copy_hl_de (int *cycles) {
+	// LD A, (HL+) / LD (DE), A / INC DE
+	cpu.a = read_byte(cpu.hl++);
+	write_byte(cpu.de, cpu.a);
+	if (block_current == NULL) {
+		// the write switched banks or locked the bus, INC DE has to be fetched like it would have been
+		cpu.pc  -= 1;
+		*cycles -= 8;
+		return;
 	}
+	cpu.de++;
 }
 
-static inline void cpu_opcode_rlc_full(enum registers reg) {
-	switch (reg) {
-	case REG_B:
-		cpu.b = cpu_opcode_rlc(cpu.b);
-		break;
-	case REG_C:
-		cpu.c = cpu_opcode_rlc(cpu.c);
-		break;
-	case REG_D:
-		cpu.d = cpu_opcode_rlc(cpu.d);
-		break;
-	case REG_E:
-		cpu.e = cpu_opcode_rlc(cpu.e);
-		break;
-	case REG_H:
-		cpu.h = cpu_opcode_rlc(cpu.h);
-		break;
-	case REG_L:
-		cpu.l = cpu_opcode_rlc(cpu.l);
-		break;
-	case REG_HL:
-		write_byte(cpu.hl, cpu_opcode_rlc(read_byte(cpu.hl)));
-		break;
-	case REG_A:
-		cpu.a = cpu_opcode_rlc(cpu.a);
-		break;
-	}
+static void cpu_fused_copy_de_hl (int *cycles) {
+	// LD A, (DE) / LD (HL+), A
+	cpu.a = read_byte(cpu.de);
+	write_byte(cpu.hl++, cpu.a);
 }
 
-static inline void cpu_opcode_rrc_full(enum registers reg) {
-	switch (reg) {
-	case REG_B:
-		cpu.b = cpu_opcode_rrc(cpu.b);
-		break;
-	case REG_C:
-		cpu.c = cpu_opcode_rrc(cpu.c);
-		break;
-	case REG_D:
-		cpu.d = cpu_opcode_rrc(cpu.d);
-		break;
-	case REG_E:
-		cpu.e = cpu_opcode_rrc(cpu.e);
-		break;
-	case REG_H:
-		cpu.h = cpu_opcode_rrc(cpu.h);
-		break;
-	case REG_L:
-		cpu.l = cpu_opcode_rrc(cpu.l);
-		break;
-	case REG_HL:
-		write_byte(cpu.hl, cpu_opcode_rrc(read_byte(cpu.hl)));
-		break;
-	case REG_A:
-		cpu.a = cpu_opcode_rrc(cpu.a);
-		break;
+static void cpu_fused_loop_b (int *cycles) {
+	// DEC B / JR NZ, r8
+	cpu.b--;
+	SET_DEC_FLAGS(cpu.b);
+	if (cpu.b != 0) {
+		cpu.pc = cpu.pc + (int8_t) IMM8;
+		*cycles += 4;
 	}
 }
 
-static inline void cpu_opcode_sla_full (enum registers reg) {
-	switch (reg) {
-	case REG_B:
-		cpu.b = cpu_opcode_sla(cpu.b);
-		break;
-	case REG_C:
-		cpu.c = cpu_opcode_sla(cpu.c);
-		break;
-	case REG_D:
-		cpu.d = cpu_opcode_sla(cpu.d);
-		break;
-	case REG_E:
-		cpu.e = cpu_opcode_sla(cpu.e);
-		break;
-	case REG_H:
-		cpu.h = cpu_opcode_sla(cpu.h);
-		break;
-	case REG_L:
-		cpu.l = cpu_opcode_sla(cpu.l);
-		break;
-	case REG_HL:
-		write_byte(cpu.hl, cpu_opcode_sla(read_byte(cpu.hl)));
-		break;
-	case REG_A:
-		cpu.a = cpu_opcode_sla(cpu.a);
-		break;
+static void cpu_fused_loop_c (int *cycles) {
+	// DEC C / JR NZ, r8
+	cpu.c--;
+	SET_DEC_FLAGS(cpu.c);
+	if (cpu.c != 0) {
+		cpu.pc = cpu.pc + (int8_t) IMM8;
+		*cycles += 4;
 	}
 }
 
-static inline void cpu_opcode_srl_full (enum registers reg) {
-	switch (reg) {
-	case REG_B:
-		cpu.b = cpu_opcode_srl(cpu.b);
-		break;
-	case REG_C:
-		cpu.c = cpu_opcode_srl(cpu.c);
-		break;
-	case REG_D:
-		cpu.d = cpu_opcode_srl(cpu.d);
-		break;
-	case REG_E:
-		cpu.e = cpu_opcode_srl(cpu.e);
-		break;
-	case REG_H:
-		cpu.h = cpu_opcode_srl(cpu.h);
-		break;
-	case REG_L:
-		cpu.l = cpu_opcode_srl(cpu.l);
-		break;
-	case REG_HL:
-		write_byte(cpu.hl, cpu_opcode_srl(read_byte(cpu.hl)));
-		break;
-	case REG_A:
-		cpu.a = cpu_opcode_srl(cpu.a);
-		break;
+static void cpu_fused_loop_bc (int *cycles) {
+	// LD A, B / OR C / JR NZ, r8
+	cpu.a = cpu.b | cpu.c;
+	SET_xOR_FLAGS();
+	if (cpu.a != 0) {
+		cpu.pc = cpu.pc + (int8_t) IMM8;
+		*cycles += 4;
 	}
 }
 
-static inline void cpu_opcode_sra_full (enum registers reg) {
-	switch (reg) {
-	case REG_B:
-		cpu.b = cpu_opcode_sra(cpu.b);
-		break;
-	case REG_C:
-		cpu.c = cpu_opcode_sra(cpu.c);
-		break;
-	case REG_D:
-		cpu.d = cpu_opcode_sra(cpu.d);
-		break;
-	case REG_E:
-		cpu.e = cpu_opcode_sra(cpu.e);
-		break;
-	case REG_H:
-		cpu.h = cpu_opcode_sra(cpu.h);
-		break;
-	case REG_L:
-		cpu.l = cpu_opcode_sra(cpu.l);
-		break;
-	case REG_HL:
-		write_byte(cpu.hl, cpu_opcode_sra(read_byte(cpu.hl)));
-		break;
-	case REG_A:
-		cpu.a = cpu_opcode_sra(cpu.a);
-		break;
+// LDH A, (a8) / CP d8 / JR cc, r8
+#define FUSED_POLL_HANDLER(cc, taken) \
+	static void cpu_fused_poll_##cc (int *cycles) { \
+		uint8_t value = cpu.imm >> 8; \
+		cpu.a = read_byte(IMM8 + 0xFF00); \
+		cpu_opcode_cp_a(value); \
+		if (taken) { \
+			cpu.pc = cpu.pc + (int8_t) cpu.imm2; \
+			*cycles += 4; \
+		} \
 	}
-}
 
+FUSED_POLL_HANDLER(nz, cpu.a != value)
+FUSED_POLL_HANDLER(z, cpu.a == value)
+FUSED_POLL_HANDLER(nc, cpu.a >= value)
+FUSED_POLL_HANDLER(c, cpu.a < value)
+
+// longer sequences first, the first enabled match wins
+static const fuse_candidate fuse_candidates[FUSE_CANDIDATES] = {
+	{"copy_hl_de", 3, {0x2A, 0x12, 0x13}, cpu_fused_copy_hl_de},
+	{"loop_bc",    3, {0x78, 0xB1, 0x20}, cpu_fused_loop_bc},
+	{"poll_nz",    3, {0xF0, 0xFE, 0x20}, cpu_fused_poll_nz},
+	{"poll_z",     3, {0xF0, 0xFE, 0x28}, cpu_fused_poll_z},
+	{"poll_nc",    3, {0xF0, 0xFE, 0x30}, cpu_fused_poll_nc},
+	{"poll_c",     3, {0xF0, 0xFE, 0x38}, cpu_fused_poll_c},
+	{"copy_de_hl", 2, {0x1A, 0x22},       cpu_fused_copy_de_hl},
+	{"loop_b",     2, {0x05, 0x20},       cpu_fused_loop_b},
+	{"loop_c",     2, {0x0D, 0x20},       cpu_fused_loop_c}
+};
+
+// decoded blocks call cb_instructions directly, this only serves the main table
 static void cpu_prefix_cb_handle (int *cycles) {
-	uint8_t instruction = read_byte(cpu.pc++);
-	*cycles += cycles_0xCB_opcodes[instruction];
-	enum registers reg = map_register(instruction);
-	// now we should mask register bits in instruction
-	instruction &= 0xF8;
-	//println("Instruction is 0x%02x, cycles %d, affected reg %d", instruction, *cycles, reg);
-
-	switch (instruction) {
-	case 0x00: // RLC
-		cpu_opcode_rlc_full(reg);
-		break;
-	case 0x08: // RRC
-		cpu_opcode_rrc_full(reg);
-		break;
-	case 0x10: // RL
-		cpu_opcode_rl_full(reg);
-		break;
-	case 0x18: // RR
-		cpu_opcode_rr_full(reg);
-		break;
-	case 0x20: // SLA
-		cpu_opcode_sla_full(reg);
-		break;
-	case 0x28: // SRA
-		cpu_opcode_sra_full(reg);
-		break;
-	case 0x30: // SWAP
-		cpu_opcode_swap(reg);
-		break;
-	case 0x38: // SRL
-		cpu_opcode_srl_full(reg);
-		break;
-	case 0x40: // BIT 0
-		cpu_opcode_bit(reg, 0);
-		break;
-	case 0x48: // BIT 1
-		cpu_opcode_bit(reg, 1);
-		break;
-	case 0x50: // BIT 2
-		cpu_opcode_bit(reg, 2);
-		break;
-	case 0x58: // BIT 3
-		cpu_opcode_bit(reg, 3);
-		break;
-	case 0x60: // BIT 4
-		cpu_opcode_bit(reg, 4);
-		break;
-	case 0x68: // BIT 5
-		cpu_opcode_bit(reg, 5);
-		break;
-	case 0x70: // BIT 6
-		cpu_opcode_bit(reg, 6);
-		break;
-	case 0x78: // BIT 7
-		cpu_opcode_bit(reg, 7);
-		break;
-	case 0x80: // RES 0
-		cpu_opcode_res(reg, 0);
-		break;
-	case 0x88: // RES 1
-		cpu_opcode_res(reg, 1);
-		break;
-	case 0x90: // RES 2
-		cpu_opcode_res(reg, 2);
-		break;
-	case 0x98: // RES 3
-		cpu_opcode_res(reg, 3);
-		break;
-	case 0xA0: // RES 4
-		cpu_opcode_res(reg, 4);
-		break;
-	case 0xA8: // RES 5
-		cpu_opcode_res(reg, 5);
-		break;
-	case 0xB0: // RES 6
-		cpu_opcode_res(reg, 6);
-		break;
-	case 0xB8: // RES 7
-		cpu_opcode_res(reg, 7);
-		break;
-	case 0xC0: // SET 0
-		cpu_opcode_set(reg, 0);
-		break;
-	case 0xC8: // SET 1
-		cpu_opcode_set(reg, 1);
-		break;
-	case 0xD0: // SET 2
-		cpu_opcode_set(reg, 2);
-		break;
-	case 0xD8: // SET 3
-		cpu_opcode_set(reg, 3);
-		break;
-	case 0xE0: // SET 4
-		cpu_opcode_set(reg, 4);
-		break;
-	case 0xE8: // SET 5
-		cpu_opcode_set(reg, 5);
-		break;
-	case 0xF0: // SET 6
-		cpu_opcode_set(reg, 6);
-		break;
-	case 0xF8: // SET 7
-		cpu_opcode_set(reg, 7);
-		break;
-	default:
-		break;
-	}
+	*cycles += cycles_0xCB_opcodes[IMM8];
+	cb_instructions[IMM8](cycles);
 }
 
 static inline void cpu_opcode_daa() {
@@ -2920,14 +4029,13 @@ static inline void cpu_opcode_daa() {
 		cpu.a = cpu.a - correction;
 	}
 
-	cpu.f = SET_FLAGS(cpu.a == 0, n_flag, 0, (correction >= 0x60));
+	cpu_set_flags(cpu.a == 0, n_flag, 0, (correction >= 0x60));
 }
 
 static inline void cpu_opcode_add_a(uint8_t value) {
-	bool h_flag = ((cpu.a & 0x0F) + (value & 0x0F)) > 0xf;
-	bool c_flag = (cpu.a + value) > 0xFF;
-	cpu.a = cpu.a + value;
-	cpu.f = SET_FLAGS(cpu.a == 0, 0, h_flag, c_flag);
+	uint16_t res = cpu.a + value;
+	cpu_lazy_flags(FLAGS_ADD, cpu.a, value, res);
+	cpu.a = res;
 }
 
 static inline void cpu_opcode_add_a_ptr_hl() {
@@ -2935,15 +4043,13 @@ static inline void cpu_opcode_add_a_ptr_hl() {
 }
 
 static inline void cpu_opcode_add_a_d8() {
-	cpu_opcode_add_a(read_byte(cpu.pc++));
+	cpu_opcode_add_a(IMM8);
 }
 
 static inline void cpu_opcode_adc_a(uint8_t value) {
-	uint8_t c_flag_now = GET_FLAG(C);
-	bool    h_flag     = ((cpu.a & 0x0F) + (value & 0x0F) + c_flag_now) > 0xf;
-	bool    c_flag     = ((uint16_t) cpu.a + value + c_flag_now) > 0xFF;
-	cpu.a = cpu.a + value + c_flag_now;
-	cpu.f = SET_FLAGS(cpu.a == 0, 0, h_flag, c_flag);
+	uint16_t res = cpu.a + value + GET_FLAG(C);
+	cpu_lazy_flags(FLAGS_ADD, cpu.a, value, res);
+	cpu.a = res;
 }
 
 static inline void cpu_opcode_adc_a_ptr_hl() {
@@ -2951,14 +4057,14 @@ static inline void cpu_opcode_adc_a_ptr_hl() {
 }
 
 static inline void cpu_opcode_adc_a_d8() {
-	cpu_opcode_adc_a(read_byte(cpu.pc++));
+	cpu_opcode_adc_a(IMM8);
 }
 
+// borrow out lands in bit 8 of the 16 bit difference, same place as carry for ADD
 static inline void cpu_opcode_sub_a(uint8_t value) {
-	int  res    = cpu.a - value;
-	bool h_flag = ((cpu.a & 0x0F) - (value & 0x0F)) < 0;
+	uint16_t res = cpu.a - value;
+	cpu_lazy_flags(FLAGS_SUB, cpu.a, value, res);
 	cpu.a = res;
-	cpu.f = SET_FLAGS(cpu.a == 0, 1, h_flag, res < 0);
 }
 
 static inline void cpu_opcode_sub_a_ptr_hl() {
@@ -2966,15 +4072,13 @@ static inline void cpu_opcode_sub_a_ptr_hl() {
 }
 
 static inline void cpu_opcode_sub_a_ptr_d8() {
-	cpu_opcode_sub_a(read_byte(cpu.pc++));
+	cpu_opcode_sub_a(IMM8);
 }
 
 static inline void cpu_opcode_sbc_a(uint8_t value) {
-	bool c_flag_now = GET_FLAG(C);
-	int  res        = (uint8_t) cpu.a - (uint8_t) value - (uint8_t) c_flag_now;
-	bool h_flag     = ((cpu.a & 0x0F) - (value & 0x0F) - c_flag_now) < 0;
-	cpu.a = (uint8_t) res;
-	cpu.f = SET_FLAGS(cpu.a == 0, 1, h_flag, res < 0);
+	uint16_t res = cpu.a - value - GET_FLAG(C);
+	cpu_lazy_flags(FLAGS_SUB, cpu.a, value, res);
+	cpu.a = res;
 }
 
 static inline void cpu_opcode_sbc_a_ptr_hl() {
@@ -2982,15 +4086,11 @@ static inline void cpu_opcode_sbc_a_ptr_hl() {
 }
 
 static inline void cpu_opcode_sbc_a_ptr_d8() {
-	cpu_opcode_sbc_a(read_byte(cpu.pc));
-	cpu.pc++;
+	cpu_opcode_sbc_a(IMM8);
 }
 
 static inline void cpu_opcode_cp_a(uint8_t value) {
-	int  res    = cpu.a - value;
-	bool h_flag = ((cpu.a & 0x0F) - (value & 0x0F)) < 0;
-	bool z_flag = (res == 0);
-	cpu.f = SET_FLAGS(z_flag, 1, h_flag, res < 0);
+	cpu_lazy_flags(FLAGS_SUB, cpu.a, value, (uint16_t) (cpu.a - value));
 }
 
 static inline void cpu_opcode_cp_a_ptr_hl() {
@@ -2998,7 +4098,7 @@ static inline void cpu_opcode_cp_a_ptr_hl() {
 }
 
 static inline void cpu_opcode_cp_a_ptr_d8() {
-	cpu_opcode_cp_a(read_byte(cpu.pc++));
+	cpu_opcode_cp_a(IMM8);
 }
 
 static inline void cpu_opcode_add_hl(uint16_t value) {
@@ -3007,7 +4107,7 @@ static inline void cpu_opcode_add_hl(uint16_t value) {
 	uint8_t  c_flag = ((res & 0x10000) != 0);
 	bool     z_flag = GET_FLAG(Z);
 	cpu.hl = (uint16_t) res;
-	cpu.f  = SET_FLAGS(z_flag, 0, h_flag, c_flag);
+	cpu_set_flags(z_flag, 0, h_flag, c_flag);
 }
 
 static inline void cpu_opcode_add_sp(int8_t value) {
@@ -3015,26 +4115,26 @@ static inline void cpu_opcode_add_sp(int8_t value) {
 	bool    h_flag = (((cpu.sp ^ value ^ (res & 0xFFFF)) & 0x10) == 0x10);
 	uint8_t c_flag = (((cpu.sp ^ value ^ (res & 0xFFFF)) & 0x100) == 0x100);
 	cpu.sp = (uint16_t) res;
-	cpu.f  = SET_FLAGS(0, 0, h_flag, c_flag);
+	cpu_set_flags(0, 0, h_flag, c_flag);
 }
 
 static inline void cpu_opcode_ccf() {
-	cpu.f = SET_FLAGS(GET_FLAG(Z), 0, 0, !GET_FLAG(C));
+	cpu_set_flags(GET_FLAG(Z), 0, 0, !GET_FLAG(C));
 }
 
 static inline void cpu_opcode_scf() {
-	cpu.f = SET_FLAGS(GET_FLAG(Z), 0, 0, true);
+	cpu_set_flags(GET_FLAG(Z), 0, 0, true);
 }
 
 static inline void cpu_opcode_cpl() {
 	cpu.a = ~cpu.a;
-	cpu.f = SET_FLAGS(GET_FLAG(Z), 1, 1, GET_FLAG(C));
+	cpu_set_flags(GET_FLAG(Z), 1, 1, GET_FLAG(C));
 }
 
 static inline void cpu_opcode_ld_hl_sp(int8_t value) {
 	int  res    = cpu.sp + value;
 	bool h_flag = ((value ^ cpu.sp ^ (res & 0xFFFF)) & 0x10) == 0x10;
 	bool c_flag = ((value ^ cpu.sp ^ (res & 0xFFFF)) & 0x100) == 0x100;
-	cpu.f  = SET_FLAGS(0, 0, h_flag, c_flag);
+	cpu_set_flags(0, 0, h_flag, c_flag);
 	cpu.hl = (uint16_t) res;
 }
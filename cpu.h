@@ -9,4 +9,62 @@ void cpu_request_interrupt (int bit);
 
 uint8_t cpu_get_dma (uint8_t start_addr, uint8_t index);
 
+// whole 0xA0 byte dma source as one plain memory block, NULL when the page has to go through the bus
+const uint8_t *cpu_get_dma_page (uint8_t start_addr);
+
+// while locked cpu sees only HRAM and IE, the rest of the bus belongs to OAM DMA
+void cpu_set_bus_locked (bool locked);
+
+// breakpoint.c calls this whenever breakpoints come or go
+void cpu_breakpoints_changed (void);
+
+// memory as the cpu sees it, without the bus lock and watchpoints
+uint8_t cpu_peek (uint16_t addr);
+
+// watch.c tells whether any watchpoint is set, only then accesses check its pages
+void cpu_set_watched (bool watched);
+
+uint64_t cpu_get_cycles (void);
+
+// translate hot ROM blocks to host code, only has an effect on x86-64 hosts
+void cpu_set_jit (bool enabled);
+
+// sets a bit per rom byte executed from now on, coverage_write saves them
+void cpu_coverage_record (void);
+
+// remember which rom blocks run from now on, cpu_aot_generate uses them as extra entry points
+void cpu_aot_record (void);
+
+// writes C for all reachable rom code of the loaded rom, tools/aot.sh builds it into a shared object
+bool cpu_aot_generate (const char *path);
+
+// runs rom code through a shared object built from cpu_aot_generate output
+bool cpu_aot_load (const char *path);
+
+// count how often each fusable opcode sequence runs from now on
+void cpu_fuse_record (void);
+
+// writes the counts as a fusion profile, sequences that ran often enough are enabled in it
+bool cpu_fuse_write (const char *path);
+
+// fuses the sequences a profile written by cpu_fuse_write enables
+bool cpu_fuse_load (const char *path);
+
+// locations at or above this are cpu addresses of code outside the rom image
+#define CPU_LOCATION_BUS 0x80000000u
+
+// rom image offset (bank*0x4000 + pc%0x4000) of the code at pc, CPU_LOCATION_BUS | pc for RAM and the boot rom
+uint32_t cpu_location (uint16_t pc);
+
+// samples bank:pc and tracks calls for profiler.c, profiler_write reports
+void cpu_set_profiler (bool enabled);
+
+// records every instruction into the trace.c ring, trace_start has to run first
+void cpu_set_trace (bool enabled);
+
+#ifdef OPCODE_PROFILER
+// prints what the opcode profiler counted so far
+void cpu_profile_report (void);
+#endif
+
 #endif /* _CPU_H_ */
\ No newline at end of file
@@ -0,0 +1,80 @@
+#ifndef _CPU_STATE_H_
+#define _CPU_STATE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Register file and core flags of the cpu. Only cpu.c and code it
+ * translates (see aot.h) look inside, everyone else goes through cpu.h.
+ */
+typedef struct {
+	struct {
+		union {
+			struct {
+				uint8_t f;
+				uint8_t a;
+			};
+			uint16_t af;
+		};
+	};
+	struct {
+		union {
+			struct {
+				uint8_t c;
+				uint8_t b;
+			};
+			uint16_t bc;
+		};
+	};
+	struct {
+		union {
+			struct {
+				uint8_t e;
+				uint8_t d;
+			};
+			uint16_t de;
+		};
+	};
+	struct {
+		union {
+			struct {
+				uint8_t l;
+				uint8_t h;
+			};
+			uint16_t hl;
+		};
+	};
+	uint16_t sp;
+	uint16_t pc;
+	uint16_t imm;
+	uint8_t  imm2; // third operand byte, only fused ops have one
+
+	bool stop;
+
+	bool halted;
+
+	bool boot_rom_enabled;
+
+	bool bus_locked;
+
+	bool ime;
+
+	uint8_t ime_delay; // EI takes effect after the instruction that follows it
+
+	bool int_pending; // the only thing cpu_step looks at, see cpu_update_interrupts
+
+	uint8_t interrupt_flag;
+
+	uint8_t interrupt_enable;
+
+	uint64_t cycles; // master clock, cycles elapsed since power on
+
+	/* last flag setting ALU op, see GET_FLAG */
+	uint8_t  flags_op;
+	uint8_t  flags_a;
+	uint8_t  flags_b;
+	uint16_t flags_res;
+} cpu_state;
+
+#endif /* _CPU_STATE_H_ */
@@ -0,0 +1,82 @@
+#include "dma.h"
+#include "cpu.h"
+#include "gpu.h"
+#include "io.h"
+#include "probes.h"
+#include "stats.h"
+
+#define DMA_LENGTH          0xA0
+#define DMA_CYCLES_PER_BYTE 4
+
+typedef struct {
+	uint8_t source; // FF46, high byte of the source address
+	bool    accurate;
+	bool    active;
+	uint8_t index;  // next byte to transfer
+	int     cycles; // cycles not yet spent on a byte
+} dma_state;
+
+static dma_state dma;
+
+static void dma_write_reg (uint16_t addr, uint8_t val);
+
+void dma_init (void) {
+	bool accurate = dma.accurate;
+
+	memset(&dma, 0x00, sizeof(dma_state));
+	dma.accurate = accurate;
+
+	io_map(0xFF46, &dma.source, 0x00, NULL, dma_write_reg);
+}
+
+void dma_set_accurate (bool enabled) {
+	dma.accurate = enabled;
+}
+
+static void dma_copy_page (uint8_t source) {
+	const uint8_t *page = cpu_get_dma_page(source);
+	uint8_t buffer[DMA_LENGTH];
+
+	if (page == NULL) {
+		for (int index = 0; index < DMA_LENGTH; ++index) {
+			buffer[index] = cpu_get_dma(source, index);
+		}
+		page = buffer;
+	}
+	gpu_oam_load(page);
+}
+
+static void dma_write_reg (uint16_t addr, uint8_t val) {
+	dma.source = val;
+	stats.dma_transfers++;
+	PROBE2(dma, val, dma.accurate);
+
+	if (!dma.accurate) {
+		dma_copy_page(val);
+		return;
+	}
+
+	// writing FF46 during a transfer restarts it from the new page
+	dma.active = true;
+	dma.index  = 0;
+	dma.cycles = 0;
+	cpu_set_bus_locked(true);
+}
+
+void dma_step (int cycles) {
+	if (!dma.active) {
+		return;
+	}
+
+	dma.cycles += cycles;
+	while (dma.cycles >= DMA_CYCLES_PER_BYTE && dma.index < DMA_LENGTH) {
+		gpu_oam_write(dma.index, cpu_get_dma(dma.source, dma.index));
+		dma.index++;
+		dma.cycles -= DMA_CYCLES_PER_BYTE;
+	}
+
+	if (dma.index == DMA_LENGTH) {
+		dma.active = false;
+		cpu_set_bus_locked(false);
+	}
+}
@@ -0,0 +1,17 @@
+#ifndef _DMA_H_
+#define _DMA_H_
+
+#include "common.h"
+
+void dma_init (void);
+
+/*
+ * Fast mode (default) copies all 160 bytes at the moment FF46 is written.
+ * Accurate mode moves one byte per M-cycle and keeps the cpu off the bus
+ * (everything except HRAM) for the 640 cycles the transfer takes.
+ */
+void dma_set_accurate (bool enabled);
+
+void dma_step (int cycles);
+
+#endif /* _DMA_H_ */
@@ -1,5 +1,10 @@
 #include "gpu.h"
 #include "cpu.h"
+#include "io.h"
+#include "perfcount.h"
+#include "probes.h"
+#include "stats.h"
+#include "timeline.h"
 
 typedef struct {
 	/* LCD CONTROL REGISTER */
@@ -14,6 +19,9 @@ typedef struct {
 	uint8_t prevline;
 
 	/* PALETTES */
+	uint8_t bgrdpalette_raw;
+	uint8_t palette0_raw;
+	uint8_t palette1_raw;
 	uint8_t bgrdpalette[4];
 	uint8_t palette0[4];
 	uint8_t palette1[4];
@@ -66,6 +74,7 @@ enum {
 };
 
 static int mode; 
+static int lcd_off_cycles; // since the last frame time counted as skipped
 static gpu_state state;
 static uint8_t   vram[0x2000]; // video ram, 8 kbytes
 static uint8_t   oam[0xA0]; // oam ram
@@ -94,6 +103,10 @@ static uint8_t inline color_to_default_palette (int color);
 
 static void inline parse_colors_from_bit_palette (uint8_t palette, uint8_t *palette_save);
 
+static void gpu_write_ly (uint16_t addr, uint8_t val);
+
+static void gpu_write_palette (uint16_t addr, uint8_t val);
+
 #ifdef DEBUG_BUILD
 
 #define DEBUG_WINDOW_WIDTH (16 * 8)
@@ -141,6 +154,21 @@ void gpu_init (void) {
 	state.curline = 0;
 	state.obj_buffer_size = 0;
 
+	io_map(0xFF40, &state.lcd_control, 0x00, NULL, NULL);
+	io_map(0xFF41, &state.lcd_stat, 0x80, NULL, NULL);
+	io_map(0xFF42, &state.scrolly, 0x00, NULL, NULL);
+	io_map(0xFF43, &state.scrollx, 0x00, NULL, NULL);
+	io_map(0xFF44, &state.curline, 0x00, NULL, gpu_write_ly);
+	io_map(0xFF45, &state.cmpline, 0x00, NULL, NULL);
+	io_map(0xFF47, &state.bgrdpalette_raw, 0x00, NULL, gpu_write_palette);
+	io_map(0xFF48, &state.palette0_raw, 0x00, NULL, gpu_write_palette);
+	io_map(0xFF49, &state.palette1_raw, 0x00, NULL, gpu_write_palette);
+	io_map(0xFF4A, &state.wndposy, 0x00, NULL, NULL);
+	io_map(0xFF4B, &state.wndposx, 0x00, NULL, NULL);
+	io_map_restore(0xFF47, gpu_write_palette);
+	io_map_restore(0xFF48, gpu_write_palette);
+	io_map_restore(0xFF49, gpu_write_palette);
+
 	screen_clear();
 	screen_vsync();
 }
@@ -158,6 +186,12 @@ void gpu_step(int cycles) {
 		status &= ~STAT_MODE_BLANK_FLAG;
 		status &= ~STAT_MODE_MEM_ACCESS_FLAG;
 		state.lcd_stat = status;
+
+		lcd_off_cycles += cycles;
+		if (lcd_off_cycles >= FRAME_CYCLES) {
+			lcd_off_cycles -= FRAME_CYCLES;
+			stats.frames_skipped++;
+		}
 		return;
 	}
 
@@ -192,6 +226,7 @@ void gpu_step(int cycles) {
 	state.lcd_stat = status;
 
 	if (current_mode != (status & STAT_MODE_MASK)) {
+		PROBE2(mode, current_mode, status & STAT_MODE_MASK);
 		switch (status & STAT_MODE_MASK) {
 			case MODE_ACCESS_OAM:
 				gpu_scan_sprite_lines(state.curline);
@@ -203,13 +238,19 @@ void gpu_step(int cycles) {
 				break;
 			case MODE_ACCESS_VRAM:
 				if (state.lcd_control & CTRL_BG_WIN_ENABLE) {
+					timeline_begin("gpu_render_bg");
 					gpu_render_bg(state.curline);
+					timeline_end();
 
 					if (state.lcd_control & CTRL_WIN_ENABLE) {
+						timeline_begin("gpu_render_window");
 						gpu_render_window(state.curline);
+						timeline_end();
 					}
 				}
+				timeline_begin("gpu_render_sprites_from_buffer");
 				gpu_render_sprites_from_buffer();
+				timeline_end();
 				break;
 			case MODE_HBLANK:
 				if (status & STAT_H_BLANK_INT_FLAG) {
@@ -217,8 +258,17 @@ void gpu_step(int cycles) {
 				}
 				break;
 			case MODE_VBLANK:
+				// handing the frame to SDL is presentation, not emulation
+				perfcount_enter(PERFCOUNT_PRESENT);
+				timeline_begin("gpu_canvas_render");
 				gpu_canvas_render();
+				timeline_end();
+				timeline_begin("screen_vsync");
 				screen_vsync();
+				timeline_end();
+				perfcount_enter(PERFCOUNT_PPU);
+				stats.frames++;
+				PROBE1(vblank, stats.frames);
 
 				if (status & STAT_V_BLANK_INT_FLAG) {
 					cpu_request_interrupt(1);
@@ -248,6 +298,10 @@ void gpu_step(int cycles) {
 		state.curline = 0;
 		state.wndlinecnt = 0;
 	}
+
+	if (state.curline != state.prevline) {
+		PROBE1(ly, state.curline);
+	}
 }
 
 static void gpu_canvas_put_pixel (int x, int y, uint8_t color) {
@@ -487,6 +541,11 @@ void gpu_oam_write (uint16_t addr, uint8_t val) {
 	oam[addr] = val;
 }
 
+// whole OAM at once, used by the fast DMA path
+void gpu_oam_load (const uint8_t *src) {
+	memcpy(oam, src, 0xA0);
+}
+
 uint8_t gpu_oam_read (uint16_t addr) {
 	return oam[addr];
 }
@@ -499,76 +558,24 @@ uint8_t gpu_read(uint16_t addr) {
 	return vram[addr];
 }
 
-void gpu_write_reg(uint16_t addr, uint8_t val) {
+static void gpu_write_ly (uint16_t addr, uint8_t val) {
+	state.curline = 0;
+}
+
+static void gpu_write_palette (uint16_t addr, uint8_t val) {
 	switch(addr) {
-	case 0xFF40:
-		state.lcd_control = val;
-		break;
-	case 0xFF41:
-		state.lcd_stat = val;
-		break;
-	case 0xFF42:
-		state.scrolly = val;
-		break;
-	case 0xFF43:
-		state.scrollx = val;
-		break;
-	case 0xFF44:
-		state.curline = 0;
-		break;
-	case 0xFF45:
-		state.cmpline = val;
-		break;
 	case 0xFF47:
+		state.bgrdpalette_raw = val;
 		parse_colors_from_bit_palette(val, state.bgrdpalette);
 		break;
 	case 0xFF48:
+		state.palette0_raw = val;
 		parse_colors_from_bit_palette(val, state.palette0);
 		break;
 	case 0xFF49:
+		state.palette1_raw = val;
 		parse_colors_from_bit_palette(val, state.palette1);
 		break;
-	case 0xFF4A:
-		state.wndposy = val;
-		break;
-	case 0xFF4B:
-		state.wndposx = val;
-		break;
-	case 0xFF46:
-		for (uint8_t index = 0; index <= 0x9F; ++index) {
-			oam[index] = cpu_get_dma(val, index);
-		}
-		break;
-	default:
-		break;
-	}
-}
-
-uint8_t gpu_read_reg(uint16_t addr) {
-	switch(addr) {
-	case 0xFF40:
-		return state.lcd_control;
-	case 0xFF41:
-		return state.lcd_stat;
-	case 0xFF42:
-		return state.scrolly;
-	case 0xFF43:
-		return state.scrollx;
-	case 0xFF44:
-		return state.curline;
-	case 0xFF45:
-		return state.cmpline;
-	case 0xFF4A:
-		return state.wndposy;
-	case 0xFF4B:
-		return state.wndposx;
-	case 0xFF47:
-	case 0xFF48:
-	case 0xFF49:
-	case 0xFF46:
-		return 0;
-	default:
-		return 0;
 	}
 }
 
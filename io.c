@@ -0,0 +1,77 @@
+#include "io.h"
+
+#define IO_REGS_COUNT 0x80
+
+typedef struct {
+	uint8_t       *data;     // points either into a subsystem state or to value below
+	uint8_t       value;
+	uint8_t       read_mask;
+	io_read_hook  read;
+	io_write_hook write;
+	io_write_hook restore;
+} io_register;
+
+static io_register regs[IO_REGS_COUNT];
+
+void io_init (void) {
+	for (int i = 0; i < IO_REGS_COUNT; ++i) {
+		regs[i].value     = 0x00;
+		regs[i].data      = &regs[i].value;
+		regs[i].read_mask = 0x00;
+		regs[i].read      = NULL;
+		regs[i].write     = NULL;
+		regs[i].restore   = NULL;
+	}
+}
+
+void io_map (uint16_t addr, uint8_t *backing, uint8_t read_mask, io_read_hook read, io_write_hook write) {
+	io_register *reg = &regs[addr & 0x7F];
+
+	reg->data      = backing ? backing : &reg->value;
+	reg->read_mask = read_mask;
+	reg->read      = read;
+	reg->write     = write;
+	reg->restore   = NULL;
+}
+
+void io_map_restore (uint16_t addr, io_write_hook restore) {
+	regs[addr & 0x7F].restore = restore;
+}
+
+uint8_t io_read (uint16_t addr) {
+	io_register *reg = &regs[addr & 0x7F];
+
+	if (reg->read) {
+		return reg->read(addr) | reg->read_mask;
+	}
+
+	return *reg->data | reg->read_mask;
+}
+
+void io_write (uint16_t addr, uint8_t val) {
+	io_register *reg = &regs[addr & 0x7F];
+
+	if (reg->write) {
+		reg->write(addr, val);
+		return;
+	}
+
+	*reg->data = val;
+}
+
+void io_save_state (uint8_t *out) {
+	for (int i = 0; i < IO_REGS_COUNT; ++i) {
+		out[i] = regs[i].read ? regs[i].read(0xFF00 | i) : *regs[i].data;
+	}
+}
+
+void io_load_state (const uint8_t *in) {
+	for (int i = 0; i < IO_REGS_COUNT; ++i) {
+		if (regs[i].restore) {
+			regs[i].restore(0xFF00 | i, in[i]);
+		}
+		else {
+			*regs[i].data = in[i];
+		}
+	}
+}
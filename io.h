@@ -0,0 +1,35 @@
+#ifndef _IO_H_
+#define _IO_H_
+
+#include "common.h"
+
+typedef uint8_t (*io_read_hook) (uint16_t addr);
+typedef void (*io_write_hook) (uint16_t addr, uint8_t val);
+
+void io_init (void);
+
+/*
+ * Maps one register of the 0xFF00-0xFF7F space.
+ * backing - byte the register lives in, NULL keeps it inside the table
+ * read_mask - unused bits, they always read as 1
+ * read/write - optional hooks for registers with side effects, plain registers pass NULL
+ */
+void io_map (uint16_t addr, uint8_t *backing, uint8_t read_mask, io_read_hook read, io_write_hook write);
+
+uint8_t io_read (uint16_t addr);
+
+void io_write (uint16_t addr, uint8_t val);
+
+/*
+ * State hook for registers whose value doesn't live in their backing byte
+ * or whose write hook has side effects, io_load_state calls it with the
+ * saved value instead of storing the byte.
+ */
+void io_map_restore (uint16_t addr, io_write_hook restore);
+
+// all 0x80 registers, hooked ones are saved through their read hook and restored through their state hook
+void io_save_state (uint8_t *out);
+
+void io_load_state (const uint8_t *in);
+
+#endif /* _IO_H_ */
@@ -0,0 +1,314 @@
+#include "jit.h"
+
+#ifdef JIT_AVAILABLE
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define JIT_ARENA_SIZE  (4*1024*1024)
+#define JIT_BLOCK_SPACE 16384 // worst case for one block, checked by jit_begin
+#define JIT_MAX_EXITS   128
+#define JIT_MAX_SLOWS   8
+
+/*
+ * Register use inside a block:
+ * rbp - state pointer, every field is addressed as [rbp + disp32]
+ * rsp - 16 byte frame, [rsp] is the cycles slot handlers get a pointer to
+ * rax, rcx, rdi - scratch, rax holds the index of the *_indexed ops
+ */
+static uint8_t *jit_arena   = NULL;
+static uint8_t *jit_pos     = NULL;
+static uint8_t *jit_start   = NULL;
+static uint8_t *jit_state   = NULL;
+static size_t  jit_page     = 0;
+static uint8_t *jit_exits[JIT_MAX_EXITS]; // rel32 fields to patch with the epilogue address
+static int     jit_exit_count = 0;
+static uint8_t *jit_slows[JIT_MAX_SLOWS]; // rel32 fields to patch with the start of the slow path
+static int     jit_slow_count = 0;
+
+static void emit8 (uint8_t val) {
+	*jit_pos++ = val;
+}
+
+static void emit16 (uint16_t val) {
+	memcpy(jit_pos, &val, sizeof(val));
+	jit_pos += sizeof(val);
+}
+
+static void emit32 (uint32_t val) {
+	memcpy(jit_pos, &val, sizeof(val));
+	jit_pos += sizeof(val);
+}
+
+static void emit64 (uint64_t val) {
+	memcpy(jit_pos, &val, sizeof(val));
+	jit_pos += sizeof(val);
+}
+
+// ModRM for [rbp + disp32] with reg or opcode extension in the middle bits
+static void emit_rbp_disp (int reg, int offset) {
+	emit8(0x80 | (reg << 3) | 0x5);
+	emit32(offset);
+}
+
+static void emit_exit_jne (void) {
+	emit8(0x0F);
+	emit8(0x85);
+	jit_exits[jit_exit_count++] = jit_pos;
+	emit32(0);
+}
+
+static void emit_slow_jcc (uint8_t condition) {
+	emit8(0x0F);
+	emit8(condition);
+	jit_slows[jit_slow_count++] = jit_pos;
+	emit32(0);
+}
+
+static void emit_patch (uint8_t *field, uint8_t *target) {
+	int32_t rel = target - (field + 4);
+	memcpy(field, &rel, sizeof(rel));
+}
+
+// changes the pages of [start, end), rounded out to whole pages
+static bool jit_protect (uint8_t *start, uint8_t *end, int prot) {
+	uintptr_t first = (uintptr_t) start & ~(jit_page - 1);
+	uintptr_t last  = ((uintptr_t) end + jit_page - 1) & ~(jit_page - 1);
+
+	if (last > (uintptr_t) jit_arena + JIT_ARENA_SIZE) {
+		last = (uintptr_t) jit_arena + JIT_ARENA_SIZE;
+	}
+	if (mprotect((void *) first, last - first, prot) != 0) {
+		println("Failed to change jit arena protection");
+		return false;
+	}
+	return true;
+}
+
+bool jit_init (void *state) {
+	if (jit_arena == NULL) {
+		// never writable and executable at once, jit_begin opens the pages a block goes to and jit_end seals them
+		jit_page  = sysconf(_SC_PAGESIZE);
+		jit_arena = mmap(NULL, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (jit_arena == MAP_FAILED) {
+			println("Failed to map jit arena");
+			jit_arena = NULL;
+			return false;
+		}
+	}
+	jit_state = state;
+	jit_reset();
+	return true;
+}
+
+void jit_reset (void) {
+	jit_pos = jit_arena;
+}
+
+bool jit_owns (jit_code code) {
+	return jit_arena != NULL && (uint8_t *) code >= jit_arena && (uint8_t *) code < jit_arena + JIT_ARENA_SIZE;
+}
+
+bool jit_begin (void) {
+	if (jit_arena == NULL || jit_pos + JIT_BLOCK_SPACE > jit_arena + JIT_ARENA_SIZE) {
+		return false;
+	}
+	// the page the last block ended on is sealed already, and nothing runs while a block is emitted
+	if (!jit_protect(jit_pos, jit_pos + JIT_BLOCK_SPACE, PROT_READ | PROT_WRITE)) {
+		return false;
+	}
+
+	jit_start      = jit_pos;
+	jit_exit_count = 0;
+	jit_slow_count = 0;
+
+	emit8(0x55);                         // push rbp
+	emit8(0x48); emit8(0x83); emit8(0xEC); emit8(0x10); // sub rsp, 16
+	emit8(0x48); emit8(0xBD);            // mov rbp, state
+	emit64((uintptr_t) jit_state);
+	return true;
+}
+
+jit_code jit_end (void) {
+	uint8_t *epilogue = jit_pos;
+
+	emit8(0x48); emit8(0x83); emit8(0xC4); emit8(0x10); // add rsp, 16
+	emit8(0x5D);                         // pop rbp
+	emit8(0xC3);                         // ret
+
+	for (int i = 0; i < jit_exit_count; ++i) {
+		emit_patch(jit_exits[i], epilogue);
+	}
+
+	if (!jit_protect(jit_start, jit_pos, PROT_READ | PROT_EXEC)) {
+		return NULL;
+	}
+	return (jit_code) (void *) jit_start;
+}
+
+void jit_store8 (int offset, uint8_t val) {
+	emit8(0xC6);                         // mov byte [rbp + offset], val
+	emit_rbp_disp(0, offset);
+	emit8(val);
+}
+
+void jit_store16 (int offset, uint16_t val) {
+	emit8(0x66); emit8(0xC7);            // mov word [rbp + offset], val
+	emit_rbp_disp(0, offset);
+	emit16(val);
+}
+
+void jit_copy8 (int dst_offset, int src_offset) {
+	emit8(0x0F); emit8(0xB6);            // movzx eax, byte [rbp + src]
+	emit_rbp_disp(0, src_offset);
+	emit8(0x88);                         // mov [rbp + dst], al
+	emit_rbp_disp(0, dst_offset);
+}
+
+void jit_inc16 (int offset) {
+	emit8(0x66); emit8(0xFF);            // inc word [rbp + offset]
+	emit_rbp_disp(0, offset);
+}
+
+void jit_dec16 (int offset) {
+	emit8(0x66); emit8(0xFF);            // dec word [rbp + offset]
+	emit_rbp_disp(1, offset);
+}
+
+void jit_add64 (int offset, int32_t val) {
+	emit8(0x48); emit8(0x81);            // add qword [rbp + offset], val
+	emit_rbp_disp(0, offset);
+	emit32(val);
+}
+
+void jit_add64_ptr (uint64_t *ptr, int32_t val) {
+	emit8(0x48); emit8(0xB8);            // mov rax, ptr
+	emit64((uintptr_t) ptr);
+	emit8(0x48); emit8(0x81); emit8(0x00); // add qword [rax], val
+	emit32(val);
+}
+
+void jit_or16_ptr (uint8_t *ptr, uint16_t mask) {
+	emit8(0x48); emit8(0xB8);            // mov rax, ptr
+	emit64((uintptr_t) ptr);
+	emit8(0x66); emit8(0x81); emit8(0x08); // or word [rax], mask
+	emit16(mask);
+}
+
+void jit_inc32_ptr (uint32_t *ptr) {
+	emit8(0x48); emit8(0xB8);            // mov rax, ptr
+	emit64((uintptr_t) ptr);
+	emit8(0xFF); emit8(0x00);            // inc dword [rax]
+}
+
+void jit_call (jit_handler handler, int cycles, int cycles_offset) {
+	emit8(0xC7); emit8(0x04); emit8(0x24); // mov dword [rsp], cycles
+	emit32(cycles);
+	emit8(0x48); emit8(0x89); emit8(0xE7); // mov rdi, rsp
+	// every call site has its own fixed target, so the host predicts it perfectly
+	emit8(0x48); emit8(0xB8);            // mov rax, handler
+	emit64((uintptr_t) handler);
+	emit8(0xFF); emit8(0xD0);            // call rax
+	emit8(0x48); emit8(0x63); emit8(0x04); emit8(0x24); // movsxd rax, dword [rsp]
+	emit8(0x48); emit8(0x01);            // add [rbp + cycles_offset], rax
+	emit_rbp_disp(0, cycles_offset);
+}
+
+void jit_exit_if_ne16 (int offset, uint16_t val) {
+	emit8(0x66); emit8(0x81);            // cmp word [rbp + offset], val
+	emit_rbp_disp(7, offset);
+	emit16(val);
+	emit_exit_jne();
+}
+
+void jit_exit_if_set8 (int offset) {
+	emit8(0x80);                         // cmp byte [rbp + offset], 0
+	emit_rbp_disp(7, offset);
+	emit8(0x00);
+	emit_exit_jne();
+}
+
+void jit_exit_if_ptr_ne (void *const *ptr, const void *val) {
+	emit8(0x48); emit8(0xB8);            // mov rax, ptr
+	emit64((uintptr_t) ptr);
+	emit8(0x48); emit8(0x8B); emit8(0x00); // mov rax, [rax]
+	emit8(0x48); emit8(0xB9);            // mov rcx, val
+	emit64((uintptr_t) val);
+	emit8(0x48); emit8(0x39); emit8(0xC8); // cmp rax, rcx
+	emit_exit_jne();
+}
+
+void jit_slow_if_set8_ptr (const bool *flag) {
+	emit8(0x48); emit8(0xB8);            // mov rax, flag
+	emit64((uintptr_t) flag);
+	emit8(0x80); emit8(0x38); emit8(0x00); // cmp byte [rax], 0
+	emit_slow_jcc(0x85);                 // jne slow
+}
+
+void jit_slow_if_outside16 (int offset, uint16_t start, uint16_t size) {
+	emit8(0x0F); emit8(0xB7);            // movzx eax, word [rbp + offset]
+	emit_rbp_disp(0, offset);
+	emit8(0x2D);                         // sub eax, start
+	emit32(start);
+	emit8(0x3D);                         // cmp eax, size
+	emit32(size);
+	emit_slow_jcc(0x83);                 // jae slow, addresses below start wrapped around
+}
+
+void jit_slow_if_set8_indexed (const bool *base) {
+	emit8(0x48); emit8(0xB9);            // mov rcx, base
+	emit64((uintptr_t) base);
+	emit8(0x80); emit8(0x3C); emit8(0x01); emit8(0x00); // cmp byte [rcx + rax], 0
+	emit_slow_jcc(0x85);                 // jne slow
+}
+
+void jit_load8_indexed (int dst_offset, const uint8_t *base) {
+	emit8(0x48); emit8(0xB9);            // mov rcx, base
+	emit64((uintptr_t) base);
+	emit8(0x0F); emit8(0xB6); emit8(0x0C); emit8(0x01); // movzx ecx, byte [rcx + rax]
+	emit8(0x88);                         // mov [rbp + dst], cl
+	emit_rbp_disp(1, dst_offset);
+}
+
+void jit_store8_indexed (uint8_t *base, int src_offset) {
+	emit8(0x48); emit8(0xBF);            // mov rdi, base
+	emit64((uintptr_t) base);
+	emit8(0x0F); emit8(0xB6);            // movzx ecx, byte [rbp + src]
+	emit_rbp_disp(1, src_offset);
+	emit8(0x88); emit8(0x0C); emit8(0x07); // mov [rdi + rax], cl
+}
+
+void jit_load8_ptr (int dst_offset, const uint8_t *ptr) {
+	emit8(0x48); emit8(0xB8);            // mov rax, ptr
+	emit64((uintptr_t) ptr);
+	emit8(0x0F); emit8(0xB6); emit8(0x08); // movzx ecx, byte [rax]
+	emit8(0x88);                         // mov [rbp + dst], cl
+	emit_rbp_disp(1, dst_offset);
+}
+
+void jit_store8_ptr (uint8_t *ptr, int src_offset) {
+	emit8(0x48); emit8(0xB8);            // mov rax, ptr
+	emit64((uintptr_t) ptr);
+	emit8(0x0F); emit8(0xB6);            // movzx ecx, byte [rbp + src]
+	emit_rbp_disp(1, src_offset);
+	emit8(0x88); emit8(0x08);            // mov [rax], cl
+}
+
+uint8_t *jit_else (void) {
+	uint8_t *jump;
+
+	emit8(0xE9);                         // jmp past the slow path
+	jump = jit_pos;
+	emit32(0);
+
+	for (int i = 0; i < jit_slow_count; ++i) {
+		emit_patch(jit_slows[i], jit_pos);
+	}
+	jit_slow_count = 0;
+	return jump;
+}
+
+void jit_end_if (uint8_t *jump) {
+	emit_patch(jump, jit_pos);
+}
+
+#endif /* JIT_AVAILABLE */
@@ -0,0 +1,87 @@
+#ifndef _JIT_H_
+#define _JIT_H_
+
+#include "common.h"
+
+/*
+ * x86-64 code emitter for the cpu recompiler. Generated code keeps the
+ * state pointer given to jit_init in a host register, all offsets below
+ * are byte offsets into that state. A block is emitted between jit_begin
+ * and jit_end, every jit_exit_* jumps straight out of it.
+ */
+#if defined(__x86_64__) && !defined(__EMSCRIPTEN__) && !defined(_WIN32)
+#define JIT_AVAILABLE
+#endif
+
+typedef void (*jit_code) (void);
+
+typedef void (*jit_handler) (int *cycles);
+
+bool jit_init (void *state);
+
+// forgets every block emitted so far, their jit_code pointers become invalid
+void jit_reset (void);
+
+// true for code emitted here, as opposed to code of a loaded --aot object
+bool jit_owns (jit_code code);
+
+// false when the arena has no room for one more block, jit_reset and try again
+bool jit_begin (void);
+
+jit_code jit_end (void);
+
+void jit_store8 (int offset, uint8_t val);
+
+void jit_store16 (int offset, uint16_t val);
+
+void jit_copy8 (int dst_offset, int src_offset);
+
+void jit_inc16 (int offset);
+
+void jit_dec16 (int offset);
+
+void jit_add64 (int offset, int32_t val);
+
+// same for a counter outside the state
+void jit_add64_ptr (uint64_t *ptr, int32_t val);
+
+// unaligned 16 bit OR, for bitmaps outside the state
+void jit_or16_ptr (uint8_t *ptr, uint16_t mask);
+
+void jit_inc32_ptr (uint32_t *ptr);
+
+// calls handler(&slot) with slot set to cycles, then adds the slot to the 64 bit counter at cycles_offset
+void jit_call (jit_handler handler, int cycles, int cycles_offset);
+
+void jit_exit_if_ne16 (int offset, uint16_t val);
+
+void jit_exit_if_set8 (int offset);
+
+void jit_exit_if_ptr_ne (void *const *ptr, const void *val);
+
+/*
+ * Inline fast path for an op, every jit_slow_if_* jumps to the slow path
+ * that starts at the next jit_else. jit_slow_if_outside16 leaves the guest
+ * address minus start in a scratch register as the index for the
+ * *_indexed ops that follow it.
+ */
+void jit_slow_if_set8_ptr (const bool *flag);
+
+void jit_slow_if_outside16 (int offset, uint16_t start, uint16_t size);
+
+void jit_slow_if_set8_indexed (const bool *base);
+
+void jit_load8_indexed (int dst_offset, const uint8_t *base);
+
+void jit_store8_indexed (uint8_t *base, int src_offset);
+
+void jit_load8_ptr (int dst_offset, const uint8_t *ptr);
+
+void jit_store8_ptr (uint8_t *ptr, int src_offset);
+
+// ends the fast path, hand the result to jit_end_if after the slow path
+uint8_t *jit_else (void);
+
+void jit_end_if (uint8_t *jump);
+
+#endif /* _JIT_H_ */
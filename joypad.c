@@ -1,4 +1,5 @@
 #include "joypad.h"
+#include "io.h"
 
 // TODO: interrupts!
 
@@ -14,6 +15,10 @@ enum {
 static uint8_t reg      = 0xFF;
 static int     state[8] = {0};
 
+void joypad_init (void) {
+	io_map(0xFF00, &reg, 0x00, joypad_read_reg, joypad_write_reg);
+}
+
 void joypad_key_up (int key) {
 	state[key] = 0;
 }
@@ -23,7 +28,7 @@ void joypad_key_down (int key) {
 }
 
 // TODO CHECK THIS LOGIC, COULD BE BROKEN DUE TO ISSUE WITH SOME CPU COMMAND
-uint8_t joypad_read_reg (void) {
+uint8_t joypad_read_reg (uint16_t addr) {
 	if (reg & INPUT_SELECT_DIRECTION_KEYS) {
 		if (state[JOYPAD_UP]) {
 			reg &= ~INPUT_UP_OR_SELECT;
@@ -62,7 +67,7 @@ uint8_t joypad_read_reg (void) {
 	return reg;
 }
 
-void joypad_write_reg (uint8_t val) {
+void joypad_write_reg (uint16_t addr, uint8_t val) {
 	reg = 0xff;
 	reg &= ~val;
 }
@@ -14,12 +14,14 @@ enum {
 	JOYPAD_BUTTON_START
 };
 
+void joypad_init (void);
+
 void joypad_key_up (int key);
 
 void joypad_key_down (int key);
 
-uint8_t joypad_read_reg (void);
+uint8_t joypad_read_reg (uint16_t addr);
 
-void joypad_write_reg (uint8_t val);
+void joypad_write_reg (uint16_t addr, uint8_t val);
 
 #endif /* _JOYPAD_H_ */
@@ -1,19 +1,166 @@
 #include "common.h"
+#include "breakpoint.h"
+#include "coverage.h"
 #include "cpu.h"
+#include "dma.h"
 #include "gpu.h"
+#include "io.h"
 #include "joypad.h"
+#include "perfcount.h"
+#include "profiler.h"
+#include "rom.h"
+#include "stats.h"
+#include "timeline.h"
 #include "timer.h"
+#include "trace.h"
+#include "watch.h"
+
+/* keep the audio queue about three frames deep */
+#define AUDIO_TARGET_FILL (AUDIO_SAMPLE_RATE/20)
+/* max deviation of the output rate from nominal, small enough to be inaudible */
+#define AUDIO_MAX_RATE_DELTA 0.005
+/* --stats rewrites its file about once per emulated second */
+#define STATS_INTERVAL_FRAMES 60
+
+static bool audio_sync = false;
+static bool perf_counters = false;
+
+// render_frame with the host counters switched between the subsystems, kept apart so the usual loop stays as it is
+static void render_frame_counted (void) {
+	int cycles = 0;
+	int frame_cycles = FRAME_CYCLES;
+	while(frame_cycles > 0) {
+		perfcount_enter(PERFCOUNT_CPU);
+		cycles = cpu_step();
+		dma_step(cycles);
+		perfcount_enter(PERFCOUNT_PPU);
+		gpu_step(cycles);
+		perfcount_enter(PERFCOUNT_TIMER);
+		timer_step();
+
+		frame_cycles -= cycles;
+	}
+	perfcount_enter(PERFCOUNT_PRESENT);
+}
 
 void render_frame () {
     int cycles = 0;
-	int frame_cycles = 71025;
+	int frame_cycles = FRAME_CYCLES;
+	timeline_begin("render_frame");
+	if (perf_counters) {
+		render_frame_counted();
+		timeline_end();
+		return;
+	}
 	while(frame_cycles > 0) {
 		cycles = cpu_step();
+		dma_step(cycles);
 		gpu_step(cycles);
-		timer_step(cycles);
+		timer_step();
 
 		frame_cycles -= cycles;
 	}
+	timeline_end();
+}
+
+// sleep until an absolute deadline, so rounding to whole milliseconds never accumulates
+static void pace_by_timer (void) {
+	static uint64_t next_frame = 0;
+	const uint64_t  freq       = SDL_GetPerformanceFrequency();
+	const uint64_t  frame_time = freq*FRAME_CYCLES/CPU_CLOCK_HZ;
+	uint64_t        now        = SDL_GetPerformanceCounter();
+
+	if (next_frame == 0 || now > next_frame + 4*frame_time) {
+		// first frame or we are far behind, don't try to catch up
+		next_frame = now;
+	}
+	next_frame += frame_time;
+
+	while (now < next_frame) {
+		uint32_t ms = (next_frame - now)*1000/freq;
+		if (ms == 0) {
+			break;
+		}
+		timeline_begin("SDL_Delay");
+		SDL_Delay(ms);
+		timeline_end();
+		now = SDL_GetPerformanceCounter();
+	}
+}
+
+// audio device drains the queue at its own clock, so its fill level tells if we run ahead or behind
+static void pace_by_audio (void) {
+	static int16_t silence[AUDIO_SAMPLE_RATE/30];
+	static double  fraction = 0.0;
+	const double   samples_per_frame = (double) AUDIO_SAMPLE_RATE*FRAME_CYCLES/CPU_CLOCK_HZ;
+	int            queued = audio_queued_samples();
+	int            count  = 0;
+
+	// dynamic rate control: stretch or shrink the frame a bit to pull the fill level back to target
+	double ratio = 1.0 + AUDIO_MAX_RATE_DELTA*(AUDIO_TARGET_FILL - queued)/AUDIO_TARGET_FILL;
+	if (ratio < 1.0 - AUDIO_MAX_RATE_DELTA) {
+		ratio = 1.0 - AUDIO_MAX_RATE_DELTA;
+	}
+	else if (ratio > 1.0 + AUDIO_MAX_RATE_DELTA) {
+		ratio = 1.0 + AUDIO_MAX_RATE_DELTA;
+	}
+
+	fraction += samples_per_frame*ratio;
+	count     = (int) fraction;
+	fraction -= count;
+
+	// there are no sound channels yet, so the queue is fed silence
+	audio_push_samples(silence, count);
+
+	timeline_begin("SDL_Delay");
+	while (audio_queued_samples() > AUDIO_TARGET_FILL) {
+		SDL_Delay(1);
+	}
+	timeline_end();
+}
+
+// begin[-end][:rwc], addresses in hex, r read, w write, c value change, writes by default
+static bool add_watch (const char *spec) {
+	char          *rest  = NULL;
+	unsigned long begin  = strtoul(spec, &rest, 16);
+	unsigned long end    = begin;
+	uint8_t       kinds  = 0;
+
+	if (*rest == '-') {
+		end = strtoul(rest + 1, &rest, 16);
+	}
+	if (*rest == ':') {
+		for (++rest; *rest != '\0'; ++rest) {
+			kinds |= (*rest == 'r') ? WATCH_READ : (*rest == 'w') ? WATCH_WRITE : (*rest == 'c') ? WATCH_CHANGE : 0;
+		}
+	}
+	else if (*rest == '\0') {
+		kinds = WATCH_WRITE;
+	}
+
+	if (begin > 0xFFFF || end > 0xFFFF || watch_add(begin, end, kinds) < 0) {
+		println("Ignoring watchpoint \'%s\'", spec);
+		return false;
+	}
+	return true;
+}
+
+// [bank:]addr[ if condition], bank and address in hex
+static bool add_breakpoint (const char *spec) {
+	char          *rest     = NULL;
+	const char    *condition = strstr(spec, " if ");
+	int           bank      = -1;
+	unsigned long addr      = strtoul(spec, &rest, 16);
+
+	if (*rest == ':') {
+		bank = addr;
+		addr = strtoul(rest + 1, &rest, 16);
+	}
+	if (addr > 0xFFFF || (*rest != '\0' && rest != condition)) {
+		println("Ignoring breakpoint \'%s\'", spec);
+		return false;
+	}
+	return breakpoint_add(bank, addr, condition ? condition + 4 : NULL) >= 0;
 }
 
 #ifdef __EMSCRIPTEN__
@@ -67,22 +214,143 @@ static EM_BOOL key_callback(int event_type, const EmscriptenKeyboardEvent *event
 #endif
 
 int main(int argc, char *argv[]) {
-	SDL_Event e     = {0};
-	bool      quit  = false;
-	int32_t   ticks = 0;
+	SDL_Event  e         = {0};
+	bool       quit      = false;
+	const char *rom_file  = NULL;
+	bool       jit       = false;
+	const char *aot_file  = NULL;
+	const char *aot_gen   = NULL;
+	const char *fuse_file = NULL;
+	const char *fuse_gen  = NULL;
+	const char *profile   = NULL;
+	const char *trace     = NULL;
+	const char *coverage  = NULL;
+	const char *stats_file = NULL;
+	int        stats_frames = 0;
+	const char *timeline  = NULL;
+	const char *watches[WATCH_MAX];
+	int        watch_count = 0;
+	const char *breaks[BREAKPOINT_MAX];
+	int        break_count = 0;
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--audio-sync") == 0) {
+			audio_sync = true;
+		}
+		else if (strcmp(argv[i], "--deterministic") == 0) {
+			rom_set_deterministic(true);
+		}
+		else if (strcmp(argv[i], "--dma-accurate") == 0) {
+			dma_set_accurate(true);
+		}
+		else if (strcmp(argv[i], "--perf-counters") == 0) {
+			perf_counters = true;
+		}
+		else if (strcmp(argv[i], "--jit") == 0) {
+			jit = true;
+		}
+		else if (strcmp(argv[i], "--aot") == 0 && i + 1 < argc) {
+			aot_file = argv[++i];
+		}
+		else if (strcmp(argv[i], "--aot-gen") == 0 && i + 1 < argc) {
+			aot_gen = argv[++i];
+		}
+		else if (strcmp(argv[i], "--fuse") == 0 && i + 1 < argc) {
+			fuse_file = argv[++i];
+		}
+		else if (strcmp(argv[i], "--fuse-gen") == 0 && i + 1 < argc) {
+			fuse_gen = argv[++i];
+		}
+		else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+			profile = argv[++i];
+		}
+		else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+			trace = argv[++i];
+		}
+		else if (strcmp(argv[i], "--coverage") == 0 && i + 1 < argc) {
+			coverage = argv[++i];
+		}
+		else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+			stats_file = argv[++i];
+		}
+		else if (strcmp(argv[i], "--timeline") == 0 && i + 1 < argc) {
+			timeline = argv[++i];
+		}
+		else if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc) {
+			if (watch_count < WATCH_MAX) {
+				watches[watch_count++] = argv[i + 1];
+			}
+			++i;
+		}
+		else if (strcmp(argv[i], "--break") == 0 && i + 1 < argc) {
+			if (break_count < BREAKPOINT_MAX) {
+				breaks[break_count++] = argv[i + 1];
+			}
+			++i;
+		}
+		else {
+			rom_file = argv[i];
+		}
+	}
 
 	common_init();
 
 	println("EMULATOR INIT");
 
 	keyboard_set_handlers(joypad_key_down, joypad_key_up);
+	io_init();
+	joypad_init();
+	timer_init();
 	gpu_init();
+	dma_init();
 	cpu_init();
+	cpu_set_jit(jit);
 
 #ifndef __EMSCRIPTEN__
-	file_load_rom("zelda.gb");
+	if (audio_sync && !audio_init()) {
+		println("Falling back to timer based frame pacing");
+		audio_sync = false;
+	}
+
+	file_load_rom(rom_file ? rom_file : "zelda.gb");
+
+	if (aot_file != NULL) {
+		cpu_aot_load(aot_file);
+	}
+	if (aot_gen != NULL) {
+		cpu_aot_record();
+	}
+	if (fuse_file != NULL) {
+		cpu_fuse_load(fuse_file);
+	}
+	if (fuse_gen != NULL) {
+		cpu_fuse_record();
+	}
+	if (profile != NULL) {
+		cpu_set_profiler(true);
+	}
+	if (trace != NULL) {
+		trace_start(trace);
+		cpu_set_trace(true);
+	}
+	if (coverage != NULL) {
+		cpu_coverage_record();
+	}
+	if (timeline != NULL) {
+		timeline_start();
+	}
+	if (perf_counters) {
+		perf_counters = perfcount_start();
+	}
+	for (int i = 0; i < watch_count; ++i) {
+		add_watch(watches[i]);
+	}
+	for (int i = 0; i < break_count; ++i) {
+		add_breakpoint(breaks[i]);
+	}
 
 	while (!quit) {
+		timeline_begin("SDL_PollEvent");
 		while (SDL_PollEvent(&e) != 0) {
 			if (e.type == SDL_QUIT) {
 				quit = true;
@@ -91,16 +359,55 @@ int main(int argc, char *argv[]) {
 			if (e.type == SDL_KEYUP || e.type == SDL_KEYDOWN) {
 				keyboard_handle_input(&e);
 			}
+
+			if (trace != NULL && e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_F12) {
+				println(trace_dump() ? "Wrote instruction trace to \'%s\'" : "Failed to write \'%s\'", trace);
+			}
 		}
+		timeline_end();
 
-		ticks = SDL_GetTicks();
 		render_frame();
-		int32_t time_to_delay = 1000/60.0f - (SDL_GetTicks() - ticks);
 
-		if (time_to_delay > 0) {
-			SDL_Delay(time_to_delay);
+		if (stats_file != NULL && ++stats_frames == STATS_INTERVAL_FRAMES) {
+			stats_write(stats_file);
+			stats_frames = 0;
+		}
+
+		if (audio_sync) {
+			pace_by_audio();
 		}
+		else {
+			pace_by_timer();
+		}
+	}
+
+	if (aot_gen != NULL) {
+		cpu_aot_generate(aot_gen);
+	}
+	if (fuse_gen != NULL) {
+		cpu_fuse_write(fuse_gen);
+	}
+	if (profile != NULL) {
+		profiler_write(profile);
+	}
+	if (trace != NULL) {
+		println(trace_dump() ? "Wrote instruction trace to \'%s\'" : "Failed to write \'%s\'", trace);
 	}
+	if (coverage != NULL) {
+		coverage_write(coverage);
+	}
+	if (stats_file != NULL) {
+		stats_write(stats_file);
+	}
+	if (timeline != NULL) {
+		timeline_write(timeline);
+	}
+	if (perf_counters) {
+		perfcount_report();
+	}
+#ifdef OPCODE_PROFILER
+	cpu_profile_report();
+#endif
 #else
 	file_load_rom("game.gb");
 	emscripten_set_keydown_callback(EMSCRIPTEN_EVENT_TARGET_WINDOW, NULL, true, key_callback);
@@ -1,31 +1,40 @@
 #include "norom.h"
+#include "probes.h"
+#include "save.h"
+#include "stats.h"
 
 static uint8_t *memory;
-static uint8_t ram[0x8000]; // just statically allocate it, maybe change in the future
+static uint8_t *ram; // sized from the cartridge header, owned by rom.c
+static uint32_t ram_size;
+static uint32_t ram_mask; // ram_size - 1, header ram sizes are powers of two
 static int rom_bank;
 static int ram_bank;
 static int mode;
 static bool ram_enabled; 
 
-static void mbc1_init(uint8_t *rom, uint64_t filesize);
+static void mbc1_init(uint8_t *rom, uint64_t filesize, uint8_t *cart_ram, uint32_t cart_ram_size);
 static uint8_t mbc1_read(uint16_t address);
 static void mbc1_write(uint16_t address, uint8_t val);
+static const uint8_t *mbc1_ptr(uint16_t address);
 
 rom_mapper_func_t mbc1_get_func(void) {
 	rom_mapper_func_t res;
 	res.init = mbc1_init;
 	res.read = mbc1_read;
 	res.write = mbc1_write;
+	res.ptr = mbc1_ptr;
 	return res;
 }
 
-static void mbc1_init(uint8_t *rom, uint64_t filesize) {
+static void mbc1_init(uint8_t *rom, uint64_t filesize, uint8_t *cart_ram, uint32_t cart_ram_size) {
 	rom_bank = 1;
 	ram_bank = 0;
 	mode = 0;
 	ram_enabled = false;
 	memory = rom;
-	memset(ram, 0x00, sizeof(ram));
+	ram = cart_ram;
+	ram_size = cart_ram_size;
+	ram_mask = cart_ram_size - 1;
 	printl("MBC1 mapper inited!\n");
 }
 
@@ -36,16 +45,26 @@ static uint8_t mbc1_read(uint16_t addr) {
 	case 0x4000 ... 0x7fff:
 		return memory[(addr - 0x4000) + (0x4000*rom_bank)];
 	case 0xa000 ... 0xbfff:
-		if (!ram_enabled) {
+		if (!ram_enabled || ram_size == 0) {
 			return 0xff;
 		}
-		return ram[(addr - 0xa000) + (0x2000*ram_bank)];
+		return ram[((addr - 0xa000) + (0x2000*ram_bank)) & ram_mask];
 	default:
 		return 0xff;
 	}
 }
 
+static const uint8_t *mbc1_ptr(uint16_t addr) {
+	if (addr < 0x4000) {
+		return memory + addr;
+	}
+	return memory + (addr - 0x4000) + (0x4000*rom_bank);
+}
+
 static void mbc1_write(uint16_t addr, uint8_t val) {
+	int old_rom_bank = rom_bank;
+	int old_ram_bank = ram_bank;
+
 	switch (addr) {
 	case 0x0000 ... 0x1fff: {
 		ram_enabled = (val == 0x0a) ? true : false;
@@ -74,12 +93,18 @@ static void mbc1_write(uint16_t addr, uint8_t val) {
 	}
 	break;
 	case 0xa000 ... 0xbfff: {
-		if (!ram_enabled) {
+		if (!ram_enabled || ram_size == 0) {
 			return;
 		}
-		ram[(addr - 0xa000) + (0x2000 * ram_bank)] = val;
+		ram[((addr - 0xa000) + (0x2000*ram_bank)) & ram_mask] = val;
+		save_mark_dirty();
 	}
 	break;
 	}
+
+	if (rom_bank != old_rom_bank || ram_bank != old_ram_bank) {
+		stats.bank_switches++;
+		PROBE2(bank_switch, rom_bank, ram_bank);
+	}
 }
 
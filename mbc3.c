@@ -0,0 +1,265 @@
+#include "mbc3.h"
+#include "cpu.h"
+#include "probes.h"
+#include "rom.h"
+#include "save.h"
+#include "stats.h"
+#include <time.h>
+
+enum {
+	RTC_SECONDS = 0,
+	RTC_MINUTES,
+	RTC_HOURS,
+	RTC_DAYS_LO,
+	RTC_DAYS_HI,
+	RTC_REGS_COUNT
+};
+
+// the save file trailer, the usual layout every emulator reads
+enum {
+	RTC_SAVE_REGS    = 0,  // RTC_REGS_COUNT little endian 32 bit words
+	RTC_SAVE_LATCHED = 20, // same for the latched registers
+	RTC_SAVE_TIME    = 40  // little endian 64 bit unix time the registers were current at
+};
+
+enum {
+	RTC_DAYS_HI_BIT8  = 0x01,
+	RTC_DAYS_HI_HALT  = 0x40,
+	RTC_DAYS_HI_CARRY = 0x80
+};
+
+static uint8_t  *memory;
+static uint8_t  *rom_bank_ptr; // base of the bank mapped at 0x4000, updated on bank switch only
+static int      rom_banks;
+static uint8_t  *ram;         // up to 4 banks of 8 kbytes, owned by rom.c
+static uint32_t ram_size;
+static uint8_t  *ram_bank_ptr;
+static uint16_t ram_addr_mask; // 2 kbytes carts mirror inside the 8 kbytes window
+static uint8_t  ram_select; // 0x00-0x03 ram bank, 0x08-0x0C rtc register
+static bool     ram_enabled;
+static uint8_t  rtc[RTC_REGS_COUNT];
+static uint8_t  rtc_latched[RTC_REGS_COUNT];
+static uint8_t  rtc_latch_prev;
+static uint64_t rtc_synced_at; // clock value in seconds that rtc registers correspond to
+static uint8_t  *rtc_save;     // clock trailer of the save file, NULL when the clock isn't saved
+
+// bits the registers actually have
+static const uint8_t rtc_masks[RTC_REGS_COUNT] = {0x3f, 0x3f, 0x1f, 0xff, 0xc1};
+
+static void mbc3_init(uint8_t *rom, uint64_t filesize, uint8_t *cart_ram, uint32_t cart_ram_size);
+static uint8_t mbc3_read(uint16_t address);
+static void mbc3_write(uint16_t address, uint8_t val);
+static const uint8_t *mbc3_ptr(uint16_t address);
+
+rom_mapper_func_t mbc3_get_func(void) {
+	rom_mapper_func_t res;
+	res.init = mbc3_init;
+	res.read = mbc3_read;
+	res.write = mbc3_write;
+	res.ptr = mbc3_ptr;
+	return res;
+}
+
+static uint64_t mbc3_rtc_now(void) {
+	if (rom_is_deterministic()) {
+		return cpu_get_cycles()/CPU_CLOCK_HZ;
+	}
+	return (uint64_t) time(NULL);
+}
+
+static void mbc3_rtc_sync(void) {
+	uint64_t now = mbc3_rtc_now();
+	uint64_t elapsed = now - rtc_synced_at;
+	rtc_synced_at = now;
+
+	if ((rtc[RTC_DAYS_HI] & RTC_DAYS_HI_HALT) || elapsed == 0) {
+		return;
+	}
+
+	uint64_t days = ((rtc[RTC_DAYS_HI] & RTC_DAYS_HI_BIT8)<<8) | rtc[RTC_DAYS_LO];
+	uint64_t total = rtc[RTC_SECONDS] + 60*rtc[RTC_MINUTES] + 3600*rtc[RTC_HOURS] + 86400*days + elapsed;
+
+	rtc[RTC_SECONDS] = total%60;
+	rtc[RTC_MINUTES] = (total/60)%60;
+	rtc[RTC_HOURS] = (total/3600)%24;
+	days = total/86400;
+
+	if (days > 0x1ff) {
+		rtc[RTC_DAYS_HI] |= RTC_DAYS_HI_CARRY;
+		days &= 0x1ff;
+	}
+	rtc[RTC_DAYS_LO] = days & 0xff;
+	rtc[RTC_DAYS_HI] = (rtc[RTC_DAYS_HI] & ~RTC_DAYS_HI_BIT8) | (days>>8);
+}
+
+static void mbc3_rtc_store(void) {
+	if (rtc_save == NULL) {
+		return;
+	}
+
+	// deterministic runs count emulated seconds, the file still gets a host time
+	uint64_t stamp = rom_is_deterministic() ? (uint64_t) time(NULL) : rtc_synced_at;
+
+	memset(rtc_save, 0x00, RTC_SAVE_TIME);
+	for (int i = 0; i < RTC_REGS_COUNT; ++i) {
+		rtc_save[RTC_SAVE_REGS + 4*i] = rtc[i];
+		rtc_save[RTC_SAVE_LATCHED + 4*i] = rtc_latched[i];
+	}
+	for (int i = 0; i < 8; ++i) {
+		rtc_save[RTC_SAVE_TIME + i] = stamp >> (8*i);
+	}
+	save_mark_dirty();
+}
+
+static void mbc3_rtc_restore(void) {
+	uint64_t stamp = 0;
+
+	if (rtc_save == NULL) {
+		return;
+	}
+	for (int i = 7; i >= 0; --i) {
+		stamp = (stamp << 8) | rtc_save[RTC_SAVE_TIME + i];
+	}
+	// saves from before the clock was kept end with zeros here
+	if (stamp == 0) {
+		return;
+	}
+
+	for (int i = 0; i < RTC_REGS_COUNT; ++i) {
+		rtc[i] = rtc_save[RTC_SAVE_REGS + 4*i] & rtc_masks[i];
+		rtc_latched[i] = rtc_save[RTC_SAVE_LATCHED + 4*i] & rtc_masks[i];
+	}
+	// the clock kept running while the emulator was closed, deterministic runs resume where they stopped
+	if (!rom_is_deterministic() && stamp <= rtc_synced_at) {
+		rtc_synced_at = stamp;
+		mbc3_rtc_sync();
+	}
+}
+
+static void mbc3_switch_rom_bank(uint8_t bank) {
+	bank &= 0x7f;
+	if (bank == 0) {
+		bank = 1;
+	}
+	rom_bank_ptr = memory + 0x4000*(bank%rom_banks);
+}
+
+static void mbc3_switch_ram_bank(uint8_t bank) {
+	if (ram_size == 0) {
+		return;
+	}
+	// header ram sizes are powers of two
+	ram_bank_ptr = ram + ((0x2000*bank) & (ram_size - 1));
+}
+
+static void mbc3_init(uint8_t *rom, uint64_t filesize, uint8_t *cart_ram, uint32_t cart_ram_size) {
+	memory = rom;
+	rom_banks = filesize/0x4000;
+	if (rom_banks < 2) {
+		rom_banks = 2;
+	}
+	mbc3_switch_rom_bank(1);
+	ram = cart_ram;
+	ram_size = cart_ram_size;
+	ram_addr_mask = (ram_size < 0x2000) ? (ram_size - 1) : 0x1fff;
+	ram_select = 0;
+	ram_bank_ptr = ram;
+	ram_enabled = false;
+	memset(rtc, 0x00, sizeof(rtc));
+	memset(rtc_latched, 0x00, sizeof(rtc_latched));
+	rtc_latch_prev = 0xff;
+	rtc_synced_at = mbc3_rtc_now();
+	rtc_save = rom_get_rtc_save();
+	mbc3_rtc_restore();
+	mbc3_rtc_store();
+	printl("MBC3 mapper inited!\n");
+}
+
+static const uint8_t *mbc3_ptr(uint16_t addr) {
+	if (addr < 0x4000) {
+		return memory + addr;
+	}
+	return rom_bank_ptr + (addr - 0x4000);
+}
+
+static uint8_t mbc3_read(uint16_t addr) {
+	switch (addr) {
+	case 0x0000 ... 0x3fff:
+		return memory[addr];
+	case 0x4000 ... 0x7fff:
+		return rom_bank_ptr[addr - 0x4000];
+	case 0xa000 ... 0xbfff:
+		if (!ram_enabled) {
+			return 0xff;
+		}
+		if (ram_select <= 0x03) {
+			if (ram_size == 0) {
+				return 0xff;
+			}
+			return ram_bank_ptr[(addr - 0xa000) & ram_addr_mask];
+		}
+		if (ram_select >= 0x08 && ram_select <= 0x0c) {
+			return rtc_latched[ram_select - 0x08];
+		}
+		return 0xff;
+	default:
+		return 0xff;
+	}
+}
+
+static void mbc3_write(uint16_t addr, uint8_t val) {
+	const uint8_t *old_rom = rom_bank_ptr;
+	const uint8_t *old_ram = ram_bank_ptr;
+
+	switch (addr) {
+	case 0x0000 ... 0x1fff: {
+		ram_enabled = ((val & 0x0f) == 0x0a) ? true : false;
+	}
+	break;
+	case 0x2000 ... 0x3fff: {
+		mbc3_switch_rom_bank(val);
+	}
+	break;
+	case 0x4000 ... 0x5fff: {
+		ram_select = val;
+		if (val <= 0x03) {
+			mbc3_switch_ram_bank(val);
+		}
+	}
+	break;
+	case 0x6000 ... 0x7fff: {
+		// writing 0x00 and then 0x01 latches current time into rtc registers
+		if (rtc_latch_prev == 0x00 && val == 0x01) {
+			mbc3_rtc_sync();
+			memcpy(rtc_latched, rtc, sizeof(rtc));
+			mbc3_rtc_store();
+		}
+		rtc_latch_prev = val;
+	}
+	break;
+	case 0xa000 ... 0xbfff: {
+		if (!ram_enabled) {
+			return;
+		}
+		if (ram_select <= 0x03) {
+			if (ram_size == 0) {
+				return;
+			}
+			ram_bank_ptr[(addr - 0xa000) & ram_addr_mask] = val;
+			save_mark_dirty();
+		}
+		else if (ram_select >= 0x08 && ram_select <= 0x0c) {
+			mbc3_rtc_sync();
+			rtc[ram_select - 0x08] = val;
+			rtc_latched[ram_select - 0x08] = val;
+			mbc3_rtc_store();
+		}
+	}
+	break;
+	}
+
+	if (rom_bank_ptr != old_rom || ram_bank_ptr != old_ram) {
+		stats.bank_switches++;
+		PROBE2(bank_switch, (rom_bank_ptr - memory)/0x4000, ram_size ? (ram_bank_ptr - ram)/0x2000 : 0);
+	}
+}
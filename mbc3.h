@@ -0,0 +1,8 @@
+#ifndef _MBC3_H
+#define _MBC3_H
+
+#include "common.h"
+
+rom_mapper_func_t mbc3_get_func(void);
+
+#endif //_MBC3_H
@@ -0,0 +1,120 @@
+#include "mbc5.h"
+#include "probes.h"
+#include "save.h"
+#include "stats.h"
+
+static uint8_t  *memory;
+static uint8_t  *rom_bank_ptr; // base of the bank mapped at 0x4000, updated on bank switch only
+static uint16_t rom_bank;      // 9 bit bank number
+static int      rom_banks;
+static uint8_t  *ram;          // sized from the cartridge header, up to 128 kbytes, owned by rom.c
+static uint8_t  *ram_bank_ptr;
+static int      ram_banks;
+static uint16_t ram_addr_mask; // 2 kbytes carts mirror inside the 8 kbytes window
+static uint8_t  ram_bank_mask; // rumble carts use bit 3 for the motor
+static bool     ram_enabled;
+
+static void mbc5_init(uint8_t *rom, uint64_t filesize, uint8_t *cart_ram, uint32_t cart_ram_size);
+static uint8_t mbc5_read(uint16_t address);
+static void mbc5_write(uint16_t address, uint8_t val);
+static const uint8_t *mbc5_ptr(uint16_t address);
+
+rom_mapper_func_t mbc5_get_func(void) {
+	rom_mapper_func_t res;
+	res.init = mbc5_init;
+	res.read = mbc5_read;
+	res.write = mbc5_write;
+	res.ptr = mbc5_ptr;
+	return res;
+}
+
+static void mbc5_switch_rom_bank(uint16_t bank) {
+	rom_bank = bank & 0x1ff;
+	rom_bank_ptr = memory + 0x4000*(rom_bank%rom_banks);
+}
+
+static void mbc5_switch_ram_bank(uint8_t bank) {
+	if (ram_banks == 0) {
+		return;
+	}
+	bank &= ram_bank_mask;
+	ram_bank_ptr = ram + 0x2000*(bank%ram_banks);
+}
+
+static void mbc5_init(uint8_t *rom, uint64_t filesize, uint8_t *cart_ram, uint32_t ram_size) {
+	memory = rom;
+	rom_banks = filesize/0x4000;
+	if (rom_banks < 2) {
+		rom_banks = 2;
+	}
+	mbc5_switch_rom_bank(1);
+
+	ram = cart_ram;
+	ram_banks = (ram_size + 0x1fff)/0x2000;
+	ram_addr_mask = (ram_size < 0x2000) ? (ram_size - 1) : 0x1fff;
+	ram_bank_mask = (rom[0x0147] >= 0x1c) ? 0x07 : 0x0f;
+	ram_bank_ptr = ram;
+	ram_enabled = false;
+
+	printl("MBC5 mapper inited, %d rom banks, %d ram bytes!\n", rom_banks, ram_size);
+}
+
+static const uint8_t *mbc5_ptr(uint16_t addr) {
+	if (addr < 0x4000) {
+		return memory + addr;
+	}
+	return rom_bank_ptr + (addr - 0x4000);
+}
+
+static uint8_t mbc5_read(uint16_t addr) {
+	switch (addr) {
+	case 0x0000 ... 0x3fff:
+		return memory[addr];
+	case 0x4000 ... 0x7fff:
+		return rom_bank_ptr[addr - 0x4000];
+	case 0xa000 ... 0xbfff:
+		if (!ram_enabled || ram == NULL) {
+			return 0xff;
+		}
+		return ram_bank_ptr[(addr - 0xa000) & ram_addr_mask];
+	default:
+		return 0xff;
+	}
+}
+
+static void mbc5_write(uint16_t addr, uint8_t val) {
+	const uint8_t *old_rom = rom_bank_ptr;
+	const uint8_t *old_ram = ram_bank_ptr;
+
+	switch (addr) {
+	case 0x0000 ... 0x1fff: {
+		ram_enabled = ((val & 0x0f) == 0x0a) ? true : false;
+	}
+	break;
+	case 0x2000 ... 0x2fff: {
+		mbc5_switch_rom_bank((rom_bank & 0x100) | val);
+	}
+	break;
+	case 0x3000 ... 0x3fff: {
+		mbc5_switch_rom_bank((rom_bank & 0xff) | ((val & 0x1)<<8));
+	}
+	break;
+	case 0x4000 ... 0x5fff: {
+		mbc5_switch_ram_bank(val);
+	}
+	break;
+	case 0xa000 ... 0xbfff: {
+		if (!ram_enabled || ram == NULL) {
+			return;
+		}
+		ram_bank_ptr[(addr - 0xa000) & ram_addr_mask] = val;
+		save_mark_dirty();
+	}
+	break;
+	}
+
+	if (rom_bank_ptr != old_rom || ram_bank_ptr != old_ram) {
+		stats.bank_switches++;
+		PROBE2(bank_switch, rom_bank, ram_banks ? (ram_bank_ptr - ram)/0x2000 : 0);
+	}
+}
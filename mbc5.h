@@ -0,0 +1,8 @@
+#ifndef _MBC5_H
+#define _MBC5_H
+
+#include "common.h"
+
+rom_mapper_func_t mbc5_get_func(void);
+
+#endif //_MBC5_H
@@ -1,24 +1,30 @@
 #include "norom.h"
+#include "save.h"
 
 static uint8_t *rom0;
-static uint8_t sram[0x4000];
+static uint8_t *sram;
+static uint32_t sram_size;
 static int bank;
 
-static void norom_init(uint8_t *rom, uint64_t filesize);
+static void norom_init(uint8_t *rom, uint64_t filesize, uint8_t *ram, uint32_t ram_size);
 static uint8_t norom_read(uint16_t address);
 static void norom_write(uint16_t address, uint8_t val);
+static const uint8_t *norom_ptr(uint16_t address);
 
 rom_mapper_func_t norom_get_func(void) {
 	rom_mapper_func_t res;
 	res.init = norom_init;
 	res.read = norom_read;
 	res.write = norom_write;
+	res.ptr = norom_ptr;
 	return res;
 }
 
-static void norom_init (uint8_t *rom, uint64_t filesize) {
+static void norom_init (uint8_t *rom, uint64_t filesize, uint8_t *ram, uint32_t ram_size) {
 	bank = 1;
 	rom0 = rom;
+	sram = ram;
+	sram_size = ram_size;
 	printl("NOROM inited!\n");
 }
 
@@ -29,16 +35,27 @@ static uint8_t norom_read (uint16_t addr) {
 	case 0x4000 ... 0x7fff:
 		return rom0[(addr - 0x4000) + (0x4000*bank)];
 	case 0xa000 ... 0xbfff:
+		if (addr - 0xa000 >= sram_size) {
+			return 0xff;
+		}
 		return sram[addr - 0xa000];
 	default:
 		return rom0[addr];
 	}
 }
 
+static const uint8_t *norom_ptr (uint16_t addr) {
+	return rom0 + addr;
+}
+
 static void norom_write (uint16_t addr, uint8_t val) {
 	switch (addr) {
 	case 0xa000 ... 0xbfff:
-		sram[addr - 0xa000] = val;
+		if (addr - 0xa000 < sram_size) {
+			sram[addr - 0xa000] = val;
+			save_mark_dirty();
+		}
+		break;
 	default:
 		printf("WTF???\n");
 	}
@@ -0,0 +1,256 @@
+#include "perfcount.h"
+
+#ifdef PERFCOUNT_AVAILABLE
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PERFCOUNT_MAX_EVENTS 5
+#define PERFCOUNT_CALIBRATE  1000 // back to back reads to measure what one switch costs
+
+typedef struct {
+	const char *name;
+	uint32_t   type;
+	uint64_t   config;
+} perfcount_event;
+
+// cycles and instructions have to stay first, the report derives IPC and the miss rates from them
+static const perfcount_event perfcount_hardware[] = {
+	{"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	{"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	{"branch misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+	{"L1D misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+	{"LLC misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+};
+
+// no PMU: time from the vDSO clock, a read() of a software counter costs more than a whole step
+static const perfcount_event perfcount_clock[] = {
+	{"ns", 0, 0},
+};
+
+static const perfcount_event       *perfcount_events = NULL;
+static int                         perfcount_count   = 0; // events counted
+static int                         perfcount_opened  = 0; // of their perf_event_open fds, none for the clock
+static int                         perfcount_fds[PERFCOUNT_MAX_EVENTS];
+static struct perf_event_mmap_page *perfcount_pages[PERFCOUNT_MAX_EVENTS];
+static uint64_t                    perfcount_last[PERFCOUNT_MAX_EVENTS];
+static uint64_t                    perfcount_totals[PERFCOUNT_SECTIONS][PERFCOUNT_MAX_EVENTS];
+static uint64_t                    perfcount_entries[PERFCOUNT_SECTIONS];
+static uint64_t                    perfcount_overhead[PERFCOUNT_MAX_EVENTS]; // per switch, taken off in the report
+static int                         perfcount_current = -1;
+static int                         perfcount_error   = 0; // errno of the last failed open
+
+static const char *perfcount_names[PERFCOUNT_SECTIONS] = {"cpu", "ppu", "timer", "present"};
+
+static void perfcount_close (void) {
+	for (int i = 0; i < perfcount_opened; ++i) {
+		if (perfcount_pages[i] != NULL) {
+			munmap(perfcount_pages[i], sysconf(_SC_PAGESIZE));
+			perfcount_pages[i] = NULL;
+		}
+		close(perfcount_fds[i]);
+	}
+	perfcount_opened = 0;
+}
+
+// one group, so all events count over exactly the same stretches
+static bool perfcount_open (const perfcount_event *events, int count) {
+	perfcount_opened = 0;
+
+	for (int i = 0; i < count; ++i) {
+		struct perf_event_attr attr = {0};
+
+		attr.size           = sizeof(attr);
+		attr.type           = events[i].type;
+		attr.config         = events[i].config;
+		attr.disabled       = (i == 0);
+		attr.exclude_kernel = 1;
+		attr.exclude_hv     = 1;
+		attr.read_format    = PERF_FORMAT_GROUP;
+
+		int fd = syscall(SYS_perf_event_open, &attr, 0, -1, (i == 0) ? -1 : perfcount_fds[0], 0);
+		if (fd < 0) {
+			perfcount_error = errno;
+			perfcount_close();
+			return false;
+		}
+		perfcount_fds[perfcount_opened++] = fd;
+
+		void *page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+		perfcount_pages[i] = (page == MAP_FAILED) ? NULL : page;
+	}
+	perfcount_events = events;
+	perfcount_count  = count;
+	return true;
+}
+
+// userspace read of one counter, false when the kernel doesn't allow it right now
+static bool perfcount_rdpmc (int i, uint64_t *value) {
+#ifdef __x86_64__
+	volatile struct perf_event_mmap_page *page = perfcount_pages[i];
+	uint32_t                             seq   = 0;
+	uint64_t                             count = 0;
+
+	if (page == NULL) {
+		return false;
+	}
+	// the kernel bumps lock around every update of the page, retry until a read saw none
+	do {
+		seq = page->lock;
+		__asm__ __volatile__ ("" ::: "memory");
+		uint32_t index = page->index;
+		if (!page->cap_user_rdpmc || index == 0) {
+			return false;
+		}
+		int64_t pmc = __builtin_ia32_rdpmc(index - 1);
+		// the register is pmc_width bits wide, sign extend it
+		pmc   = (int64_t) ((uint64_t) pmc << (64 - page->pmc_width)) >> (64 - page->pmc_width);
+		count = page->offset + pmc;
+		__asm__ __volatile__ ("" ::: "memory");
+	} while (page->lock != seq);
+
+	*value = count;
+	return true;
+#else
+	return false;
+#endif
+}
+
+static void perfcount_read (uint64_t *values) {
+	uint64_t group[1 + PERFCOUNT_MAX_EVENTS];
+	int      i = 0;
+
+	if (perfcount_events == perfcount_clock) {
+		struct timespec now;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		values[0] = now.tv_sec*1000000000ull + now.tv_nsec;
+		return;
+	}
+
+	while (i < perfcount_count && perfcount_rdpmc(i, &values[i])) {
+		++i;
+	}
+	if (i == perfcount_count) {
+		return;
+	}
+	// nr first, then the values in the order the events joined the group
+	if (read(perfcount_fds[0], group, sizeof(group)) >= (ssize_t) ((1 + perfcount_count)*sizeof(uint64_t))) {
+		memcpy(values, &group[1], perfcount_count*sizeof(uint64_t));
+	}
+}
+
+bool perfcount_start (void) {
+	if (perfcount_open(perfcount_hardware, sizeof(perfcount_hardware)/sizeof(perfcount_hardware[0]))) {
+		println("Counting cycles, instructions, branch, L1D and LLC misses per subsystem");
+	}
+	else {
+		println("No hardware counters (%s), only measuring time per subsystem", strerror(perfcount_error));
+		if (perfcount_error == EACCES || perfcount_error == EPERM) {
+			println("See /proc/sys/kernel/perf_event_paranoid");
+		}
+		perfcount_events = perfcount_clock;
+		perfcount_count  = 1;
+	}
+
+	memset(perfcount_totals, 0x00, sizeof(perfcount_totals));
+	memset(perfcount_entries, 0x00, sizeof(perfcount_entries));
+	if (perfcount_opened > 0) {
+		ioctl(perfcount_fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(perfcount_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+
+	// a switch reads every counter once, part of that lands in the section left and part in the one entered
+	uint64_t first[PERFCOUNT_MAX_EVENTS];
+	perfcount_read(first);
+	for (int i = 0; i < PERFCOUNT_CALIBRATE; ++i) {
+		perfcount_read(perfcount_last);
+	}
+	for (int i = 0; i < perfcount_count; ++i) {
+		perfcount_overhead[i] = (perfcount_last[i] - first[i])/PERFCOUNT_CALIBRATE;
+	}
+
+	perfcount_read(perfcount_last);
+	perfcount_current = PERFCOUNT_PRESENT;
+	return true;
+}
+
+// everything since the last switch goes to the current section
+static void perfcount_charge (void) {
+	uint64_t now[PERFCOUNT_MAX_EVENTS];
+
+	perfcount_read(now);
+	for (int i = 0; i < perfcount_count; ++i) {
+		perfcount_totals[perfcount_current][i] += now[i] - perfcount_last[i];
+		perfcount_last[i] = now[i];
+	}
+}
+
+void perfcount_enter (enum perfcount_section section) {
+	if (perfcount_current < 0 || (int) section == perfcount_current) {
+		return;
+	}
+
+	perfcount_charge();
+	perfcount_current = section;
+	perfcount_entries[section]++;
+}
+
+void perfcount_report (void) {
+	uint64_t all = 0;
+
+	if (perfcount_current < 0) {
+		return;
+	}
+	perfcount_charge();
+
+	for (int section = 0; section < PERFCOUNT_SECTIONS; ++section) {
+		for (int i = 0; i < perfcount_count; ++i) {
+			uint64_t overhead = perfcount_entries[section]*perfcount_overhead[i];
+
+			perfcount_totals[section][i] -= (overhead < perfcount_totals[section][i]) ? overhead : perfcount_totals[section][i];
+		}
+		all += perfcount_totals[section][0];
+	}
+
+	println("Host counters per subsystem, user space only, %llu %s per switch taken off:",
+		(unsigned long long) perfcount_overhead[0], perfcount_events[0].name);
+	for (int section = 0; section < PERFCOUNT_SECTIONS; ++section) {
+		const uint64_t *totals = perfcount_totals[section];
+
+		printl("%-8s %5.1f%% %10llu entries", perfcount_names[section], all ? 100.0*totals[0]/all : 0.0,
+			(unsigned long long) perfcount_entries[section]);
+		for (int i = 0; i < perfcount_count; ++i) {
+			printl("  %s %llu", perfcount_events[i].name, (unsigned long long) totals[i]);
+		}
+		if (perfcount_count > 2 && totals[0] > 0 && totals[1] > 0) {
+			printl("  IPC %.2f", (double) totals[1]/totals[0]);
+			for (int i = 2; i < perfcount_count; ++i) {
+				printl("  %s/1k instructions %.2f", perfcount_events[i].name, 1000.0*totals[i]/totals[1]);
+			}
+		}
+		println("");
+	}
+
+	perfcount_current = -1;
+	perfcount_close();
+}
+
+#else
+
+bool perfcount_start (void) {
+	println("Hardware counters are only available on Linux");
+	return false;
+}
+
+void perfcount_enter (enum perfcount_section section) {
+}
+
+void perfcount_report (void) {
+}
+
+#endif /* PERFCOUNT_AVAILABLE */
@@ -0,0 +1,37 @@
+#ifndef _PERFCOUNT_H_
+#define _PERFCOUNT_H_
+
+#include "common.h"
+
+/*
+ * Host hardware counters per emulator subsystem, from one perf_event_open
+ * group of cycles, instructions, branch misses, L1D read misses and LLC
+ * misses. perfcount_enter charges what the counters moved since the last
+ * switch to the section that was running and makes another one current.
+ * On x86-64 the counters are read with rdpmc from their mmap pages, so a
+ * switch costs some tens of cycles instead of a syscall. Hosts without a
+ * PMU (most VMs) fall back to the monotonic clock, which still tells the
+ * sections' shares of time apart. What one switch costs is measured at
+ * start and taken off again in the report.
+ */
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#define PERFCOUNT_AVAILABLE
+#endif
+
+enum perfcount_section {
+	PERFCOUNT_CPU,     // cpu_step and dma_step
+	PERFCOUNT_PPU,     // gpu_step, scanline rendering
+	PERFCOUNT_TIMER,   // timer_step
+	PERFCOUNT_PRESENT, // frame upload, vsync, event polling and pacing
+	PERFCOUNT_SECTIONS
+};
+
+// opens the counters and makes PERFCOUNT_PRESENT current, false when there are none
+bool perfcount_start (void);
+
+void perfcount_enter (enum perfcount_section section);
+
+// prints the counters, IPC and misses per 1000 instructions of each section
+void perfcount_report (void);
+
+#endif /* _PERFCOUNT_H_ */
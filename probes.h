@@ -0,0 +1,28 @@
+#ifndef _PROBES_H_
+#define _PROBES_H_
+
+/*
+ * USDT probes for bpftrace and perf on running instances, provider
+ * smallconsole. With sys/sdt.h (systemtap-sdt-dev) on Linux every probe is
+ * a single NOP plus a note telling tracers where to patch it and where its
+ * arguments live, elsewhere they expand to nothing. List them with
+ * "bpftrace -l 'usdt:./smallconsole:*'".
+ */
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PROBES_AVAILABLE
+#endif
+#endif
+
+#ifdef PROBES_AVAILABLE
+#define PROBE1(name, a)       DTRACE_PROBE1(smallconsole, name, a)
+#define PROBE2(name, a, b)    DTRACE_PROBE2(smallconsole, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(smallconsole, name, a, b, c)
+#else
+#define PROBE1(name, a)       do {} while (0)
+#define PROBE2(name, a, b)    do {} while (0)
+#define PROBE3(name, a, b, c) do {} while (0)
+#endif
+
+#endif /* _PROBES_H_ */
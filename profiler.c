@@ -0,0 +1,218 @@
+#include "profiler.h"
+#include "cpu.h"
+
+#define PROFILER_MAX_NODES 16384
+#define PROFILER_MAX_DEPTH 256
+#define PROFILER_SLOTS     8192 // hash tables for routines and hot spots, power of two
+#define PROFILER_TOP       40
+#define PROFILER_NAME_SIZE 16 // ";BBB:AAAA" for 9 bit banks, with room to spare
+// profiler_call adds a node before it checks the depth, so the tree can be one deeper than the frames
+#define PROFILER_PATH_SIZE ((PROFILER_MAX_DEPTH + 2)*PROFILER_NAME_SIZE)
+
+typedef struct {
+	uint32_t routine;
+	int      parent;
+	int      child;   // first callee, -1 for none
+	int      sibling;
+	uint64_t calls;
+	uint64_t samples; // taken while this was the innermost routine
+} profiler_node;
+
+typedef struct {
+	int      node;    // caller to go back to
+	uint16_t sp;
+} profiler_frame;
+
+// one routine or one hot spot, slot is free while used is false
+typedef struct {
+	bool     used;
+	uint32_t location;
+	uint64_t self;
+	uint64_t total;
+	uint64_t calls;
+	int      active;  // times it is on the path being walked, recursion counts total only once
+} profiler_entry;
+
+static profiler_node  profiler_nodes[PROFILER_MAX_NODES];
+static int            profiler_node_count = 0;
+static profiler_frame profiler_frames[PROFILER_MAX_DEPTH];
+static int            profiler_depth      = 0;
+static int            profiler_current    = 0;
+static uint64_t       profiler_samples    = 0;
+static profiler_entry profiler_spots[PROFILER_SLOTS];
+static profiler_entry profiler_routines[PROFILER_SLOTS];
+
+static profiler_entry *profiler_lookup (profiler_entry *table, uint32_t location) {
+	uint32_t slot = (location * 2654435761u) & (PROFILER_SLOTS - 1);
+
+	for (int i = 0; i < PROFILER_SLOTS; ++i, slot = (slot + 1) & (PROFILER_SLOTS - 1)) {
+		if (!table[slot].used) {
+			table[slot].used     = true;
+			table[slot].location = location;
+			return &table[slot];
+		}
+		if (table[slot].location == location) {
+			return &table[slot];
+		}
+	}
+	return NULL;
+}
+
+static void profiler_name (uint32_t location, char *name, int size) {
+	if (location & CPU_LOCATION_BUS) {
+		snprintf(name, size, "%04X", location & 0xFFFF);
+	}
+	else {
+		uint32_t bank = location >> 14;
+		snprintf(name, size, "%02X:%04X", bank, (bank ? 0x4000 : 0x0000) | (location & 0x3FFF));
+	}
+}
+
+void profiler_start (uint32_t root) {
+	memset(profiler_spots, 0x00, sizeof(profiler_spots));
+	memset(profiler_routines, 0x00, sizeof(profiler_routines));
+	profiler_nodes[0] = (profiler_node) {root, -1, -1, -1, 1, 0};
+	profiler_node_count = 1;
+	profiler_depth      = 0;
+	profiler_current    = 0;
+	profiler_samples    = 0;
+}
+
+void profiler_call (uint32_t routine, uint16_t sp) {
+	int node = profiler_nodes[profiler_current].child;
+
+	while (node >= 0 && profiler_nodes[node].routine != routine) {
+		node = profiler_nodes[node].sibling;
+	}
+	if (node < 0) {
+		if (profiler_node_count == PROFILER_MAX_NODES) {
+			// out of nodes, the callee is billed to its caller
+			return;
+		}
+		node = profiler_node_count++;
+		profiler_nodes[node] = (profiler_node) {routine, profiler_current, -1, profiler_nodes[profiler_current].child, 0, 0};
+		profiler_nodes[profiler_current].child = node;
+	}
+	if (profiler_depth == PROFILER_MAX_DEPTH) {
+		return;
+	}
+
+	profiler_frames[profiler_depth++] = (profiler_frame) {profiler_current, sp};
+	profiler_current = node;
+	profiler_nodes[node].calls++;
+}
+
+void profiler_return (uint16_t sp) {
+	// frames below sp were dropped by code that popped its return address, they end here too
+	while (profiler_depth > 0 && profiler_frames[profiler_depth - 1].sp <= sp) {
+		profiler_current = profiler_frames[--profiler_depth].node;
+	}
+}
+
+void profiler_sample (uint32_t location) {
+	profiler_entry *spot = profiler_lookup(profiler_spots, location);
+
+	profiler_nodes[profiler_current].samples++;
+	profiler_samples++;
+	if (spot != NULL) {
+		spot->self++;
+	}
+}
+
+// writes the folded line of node and everything below it, returns the samples of all of them
+static uint64_t profiler_walk (FILE *out, int node, char *path, int length) {
+	profiler_node  *current = &profiler_nodes[node];
+	profiler_entry *routine = profiler_lookup(profiler_routines, current->routine);
+	uint64_t       total    = current->samples;
+
+	// a full path isn't extended any further, deeper nodes show up under their last ancestor that fit
+	if (length + PROFILER_NAME_SIZE <= PROFILER_PATH_SIZE) {
+		if (length > 0) {
+			path[length++] = ';';
+		}
+		profiler_name(current->routine, path + length, PROFILER_NAME_SIZE - 1);
+		length += strlen(path + length);
+	}
+	if (current->samples > 0) {
+		fprintf(out, "%.*s %llu\n", length, path, (unsigned long long) current->samples*PROFILER_INTERVAL);
+	}
+
+	if (routine != NULL) {
+		routine->active++;
+	}
+	for (int child = current->child; child >= 0; child = profiler_nodes[child].sibling) {
+		total += profiler_walk(out, child, path, length);
+	}
+	if (routine != NULL) {
+		routine->active--;
+		routine->self  += current->samples;
+		routine->calls += current->calls;
+		if (routine->active == 0) {
+			routine->total += total;
+		}
+	}
+	return total;
+}
+
+static const profiler_entry *profiler_sort_table = NULL;
+
+static int profiler_compare_total (const void *a, const void *b) {
+	uint64_t total_a = profiler_sort_table[*(const int *) a].total;
+	uint64_t total_b = profiler_sort_table[*(const int *) b].total;
+
+	return (total_a < total_b) - (total_a > total_b);
+}
+
+static int profiler_compare_self (const void *a, const void *b) {
+	uint64_t self_a = profiler_sort_table[*(const int *) a].self;
+	uint64_t self_b = profiler_sort_table[*(const int *) b].self;
+
+	return (self_a < self_b) - (self_a > self_b);
+}
+
+static void profiler_sort (int *order, const profiler_entry *table, int (*compare) (const void *, const void *)) {
+	for (int i = 0; i < PROFILER_SLOTS; ++i) {
+		order[i] = i;
+	}
+	profiler_sort_table = table;
+	qsort(order, PROFILER_SLOTS, sizeof(int), compare);
+}
+
+bool profiler_write (const char *path) {
+	static char path_buffer[PROFILER_PATH_SIZE];
+	static int  order[PROFILER_SLOTS];
+	char        name[16];
+	uint64_t    total = profiler_samples ? profiler_samples : 1;
+
+	FILE *out = fopen(path, "w");
+	if (out == NULL) {
+		println("Failed to open '%s'", path);
+		return false;
+	}
+	memset(profiler_routines, 0x00, sizeof(profiler_routines));
+	profiler_walk(out, 0, path_buffer, 0);
+	fclose(out);
+	println("Wrote %llu samples as folded stacks to '%s'", (unsigned long long) profiler_samples, path);
+
+	profiler_sort(order, profiler_routines, profiler_compare_total);
+	println("routine         total cycles   share     self cycles   share        calls");
+	for (int i = 0; i < PROFILER_TOP && profiler_routines[order[i]].total > 0; ++i) {
+		const profiler_entry *routine = &profiler_routines[order[i]];
+
+		profiler_name(routine->location, name, sizeof(name));
+		println("%-8s %18llu %6.2f%% %15llu %6.2f%% %12llu", name,
+			(unsigned long long) routine->total*PROFILER_INTERVAL, 100.0*routine->total/total,
+			(unsigned long long) routine->self*PROFILER_INTERVAL, 100.0*routine->self/total,
+			(unsigned long long) routine->calls);
+	}
+
+	profiler_sort(order, profiler_spots, profiler_compare_self);
+	println("hot spot            samples   share");
+	for (int i = 0; i < PROFILER_TOP && profiler_spots[order[i]].self > 0; ++i) {
+		const profiler_entry *spot = &profiler_spots[order[i]];
+
+		profiler_name(spot->location, name, sizeof(name));
+		println("%-8s %18llu %6.2f%%", name, (unsigned long long) spot->self, 100.0*spot->self/total);
+	}
+	return true;
+}
@@ -0,0 +1,27 @@
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include "common.h"
+
+/*
+ * Sampling profiler for guest code. cpu.c reports calls and returns and
+ * takes a sample every PROFILER_INTERVAL cycles, locations are the ones
+ * cpu_location hands out. Samples are kept per node of a call tree, so
+ * taking one is a counter increment.
+ */
+#define PROFILER_INTERVAL 1009 // cycles between samples, prime so it doesn't lock on to frame or line timing
+
+void profiler_start (uint32_t root);
+
+// routine is the location of the call target, sp where its return address lives
+void profiler_call (uint32_t routine, uint16_t sp);
+
+// sp the return address was popped from
+void profiler_return (uint16_t sp);
+
+void profiler_sample (uint32_t location);
+
+// writes folded stacks in cycles for flamegraph tools and prints the routine and hot spot tables
+bool profiler_write (const char *path);
+
+#endif /* _PROFILER_H_ */
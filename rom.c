@@ -1,10 +1,106 @@
 #include "rom.h"
 #include "norom.h"
 #include "mbc1.h"
+#include "mbc3.h"
+#include "mbc5.h"
+#include "save.h"
 
 static rom_mapper_func_t cb;
+static bool deterministic = false;
+static uint8_t *ram = NULL;
+static bool ram_is_save = false;
+static uint8_t *rtc_save = NULL;
+static const uint8_t *image = NULL;
+static uint64_t image_size = 0;
+
+bool rom_is_supported (int type) {
+	switch (type) {
+		case 0x00:
+		case 0x01:
+		case 0x02:
+		case 0x03:
+		case 0x0F:
+		case 0x10:
+		case 0x11:
+		case 0x12:
+		case 0x13:
+		case 0x19:
+		case 0x1A:
+		case 0x1B:
+		case 0x1C:
+		case 0x1D:
+		case 0x1E:
+			return true;
+		default:
+			return false;
+	}
+}
+
+uint32_t rom_ram_size (const uint8_t *rom) {
+	switch (rom[0x0149]) {
+		case 0x01:
+			return 0x800;
+		case 0x02:
+			return 0x2000;
+		case 0x03:
+			return 0x8000;
+		case 0x04:
+			return 0x20000;
+		case 0x05:
+			return 0x10000;
+		default:
+			return 0;
+	}
+}
+
+uint32_t rom_size (const uint8_t *rom) {
+	switch (rom[0x0148]) {
+		case 0x52:
+			return 72*0x4000;
+		case 0x53:
+			return 80*0x4000;
+		case 0x54:
+			return 96*0x4000;
+		default:
+			return (rom[0x0148] <= 0x08) ? 0x8000 << rom[0x0148] : 0;
+	}
+}
+
+bool rom_has_battery (int type) {
+	switch (type) {
+		case 0x03:
+		case 0x0F:
+		case 0x10:
+		case 0x13:
+		case 0x1B:
+		case 0x1E:
+			return true;
+		default:
+			return false;
+	}
+}
+
+bool rom_has_rtc (int type) {
+	return type == 0x0F || type == 0x10;
+}
+
+void rom_set_deterministic (bool enabled) {
+	deterministic = enabled;
+}
+
+bool rom_is_deterministic (void) {
+	return deterministic;
+}
+
+void rom_load (const char *rom_filename, uint8_t *rom, uint64_t filesize, int type) {
+	uint32_t ram_size  = rom_ram_size(rom);
+	uint32_t save_size = ram_size + (rom_has_rtc(type) ? ROM_RTC_SAVE_SIZE : 0);
+
+	rom_unload();
+
+	image      = rom;
+	image_size = filesize;
 
-void rom_load (uint8_t *rom, uint64_t filesize, int type) {
 	switch(type) {
 		case 0x0:
 			cb = norom_get_func();
@@ -14,19 +110,72 @@ void rom_load (uint8_t *rom, uint64_t filesize, int type) {
 		case 0x3:
 			cb = mbc1_get_func();
 			break;
+		case 0x0F:
+		case 0x10:
+		case 0x11:
+		case 0x12:
+		case 0x13:
+			cb = mbc3_get_func();
+			break;
+		case 0x19:
+		case 0x1A:
+		case 0x1B:
+		case 0x1C:
+		case 0x1D:
+		case 0x1E:
+			cb = mbc5_get_func();
+			break;
 		default:
 			break;
 	}
 
-	cb.init(rom, filesize);
+	if (save_size > 0 && rom_has_battery(type)) {
+		ram = save_open(rom_filename, save_size);
+		ram_is_save = (ram != NULL);
+	}
+	if (ram_is_save && rom_has_rtc(type)) {
+		rtc_save = ram + ram_size;
+	}
+	if (ram_size > 0 && ram == NULL) {
+		ram = calloc(ram_size, sizeof(uint8_t));
+	}
+
+	cb.init(rom, filesize, ram, ram ? ram_size : 0);
 
 	printf("ROM %02x inited!\n", type);
 }
 
+void rom_unload (void) {
+	if (ram_is_save) {
+		save_close();
+	}
+	else {
+		free(ram);
+	}
+	ram = NULL;
+	ram_is_save = false;
+	rtc_save = NULL;
+	image = NULL;
+	image_size = 0;
+}
+
 uint8_t rom_read (uint16_t addr) {
 	return cb.read(addr);
 }
 
+const uint8_t *rom_get_ptr (uint16_t addr) {
+	return cb.ptr(addr);
+}
+
+uint8_t *rom_get_rtc_save (void) {
+	return rtc_save;
+}
+
+const uint8_t *rom_get_image (uint64_t *size) {
+	*size = image_size;
+	return image;
+}
+
 void rom_write (uint16_t addr, uint8_t val) {
 	cb.write(addr, val);
 }
@@ -3,10 +3,42 @@
 
 #include "common.h"
 
-void rom_load (uint8_t *rom, uint64_t filesize, int type);
+bool rom_is_supported (int type);
+
+// cartridge ram size in bytes from the header byte 0x149
+uint32_t rom_ram_size (const uint8_t *rom);
+
+// rom size in bytes from the header byte 0x148, 0 for unknown values
+uint32_t rom_size (const uint8_t *rom);
+
+// RTC and similar host clock driven state follow emulated cycles instead
+void rom_set_deterministic (bool enabled);
+
+bool rom_is_deterministic (void);
+
+// battery backed cartridges keep their ram in a save file next to the rom
+bool rom_has_battery (int type);
+
+// MBC3 with a clock, its registers follow the ram in the save file
+bool rom_has_rtc (int type);
+
+#define ROM_RTC_SAVE_SIZE 48 // registers and latched registers as 32 bit words, then a 64 bit unix time
+
+// the clock trailer of the save file, NULL without a battery backed clock
+uint8_t *rom_get_rtc_save (void);
+
+void rom_load (const char *rom_filename, uint8_t *rom, uint64_t filesize, int type);
+
+void rom_unload (void);
 
 uint8_t rom_read (uint16_t addr);
 
+// pointer to the mapped rom byte at 0x0000-0x7FFF, stays valid until the next bank switch
+const uint8_t *rom_get_ptr (uint16_t addr);
+
+// whole rom file, bank n starts at n*0x4000, NULL while nothing is loaded
+const uint8_t *rom_get_image (uint64_t *size);
+
 void rom_write (uint16_t addr, uint8_t val);
 
 #endif //_ROM_H
@@ -0,0 +1,150 @@
+#include "save.h"
+
+#if !defined(__EMSCRIPTEN__) && !defined(_WIN32)
+#define SAVE_USE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define SAVE_SYNC_INTERVAL_MS 1000
+#define SAVE_POLL_MS          50
+
+static char        *save_path  = NULL;
+static uint8_t     *save_data  = NULL;
+static uint32_t    save_size   = 0;
+static SDL_atomic_t dirty;
+
+#ifdef SAVE_USE_MMAP
+static int          save_fd     = -1;
+static SDL_Thread   *sync_thread = NULL;
+static SDL_atomic_t sync_running;
+
+static int save_sync_thread (void *data) {
+	int waited = 0;
+
+	while (SDL_AtomicGet(&sync_running)) {
+		SDL_Delay(SAVE_POLL_MS);
+		waited += SAVE_POLL_MS;
+
+		if (waited < SAVE_SYNC_INTERVAL_MS) {
+			continue;
+		}
+		waited = 0;
+
+		// flag is dropped before syncing, so a write racing with msync marks the ram again
+		if (SDL_AtomicSet(&dirty, 0)) {
+			msync(save_data, save_size, MS_SYNC);
+		}
+	}
+
+	return 0;
+}
+#endif
+
+static char *save_make_path (const char *rom_filename) {
+	size_t     len  = strlen(rom_filename);
+	const char *dot = strrchr(rom_filename, '.');
+	char       *path = NULL;
+
+	if (dot != NULL && strchr(dot, '/') == NULL) {
+		len = dot - rom_filename;
+	}
+
+	path = malloc(len + sizeof(".sav"));
+	memcpy(path, rom_filename, len);
+	memcpy(path + len, ".sav", sizeof(".sav"));
+	return path;
+}
+
+uint8_t *save_open (const char *rom_filename, uint32_t size) {
+	save_close();
+
+	save_path = save_make_path(rom_filename);
+	save_size = size;
+	SDL_AtomicSet(&dirty, 0);
+
+#ifdef SAVE_USE_MMAP
+	struct stat st;
+
+	save_fd = open(save_path, O_RDWR | O_CREAT, 0644);
+	if (save_fd < 0 || fstat(save_fd, &st) != 0) {
+		println("Failed to open save file \'%s\'", save_path);
+		save_close();
+		return NULL;
+	}
+
+	if (st.st_size < size && ftruncate(save_fd, size) != 0) {
+		println("Failed to resize save file \'%s\'", save_path);
+		save_close();
+		return NULL;
+	}
+
+	save_data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, save_fd, 0);
+	if (save_data == MAP_FAILED) {
+		println("Failed to map save file \'%s\'", save_path);
+		save_data = NULL;
+		save_close();
+		return NULL;
+	}
+
+	SDL_AtomicSet(&sync_running, 1);
+	sync_thread = SDL_CreateThread(save_sync_thread, "save sync", NULL);
+#else
+	// no shared mappings or threads here, read once and write back on close
+	save_data = calloc(size, sizeof(uint8_t));
+
+	FILE *file = fopen(save_path, "rb");
+	if (file != NULL) {
+		if (fread(save_data, 0x1, size, file) != size) {
+			println("Save file \'%s\' is shorter than cartridge ram", save_path);
+		}
+		fclose(file);
+	}
+#endif
+
+	println("Cartridge ram is backed by \'%s\'", save_path);
+	return save_data;
+}
+
+void save_mark_dirty (void) {
+	// plain load first, most writes find the flag already set
+	if (!SDL_AtomicGet(&dirty)) {
+		SDL_AtomicSet(&dirty, 1);
+	}
+}
+
+void save_close (void) {
+#ifdef SAVE_USE_MMAP
+	if (sync_thread != NULL) {
+		SDL_AtomicSet(&sync_running, 0);
+		SDL_WaitThread(sync_thread, NULL);
+		sync_thread = NULL;
+	}
+
+	if (save_data != NULL) {
+		msync(save_data, save_size, MS_SYNC);
+		munmap(save_data, save_size);
+	}
+
+	if (save_fd >= 0) {
+		close(save_fd);
+		save_fd = -1;
+	}
+#else
+	if (save_data != NULL && SDL_AtomicGet(&dirty)) {
+		FILE *file = fopen(save_path, "wb");
+		if (file != NULL) {
+			fwrite(save_data, 0x1, save_size, file);
+			fclose(file);
+		}
+	}
+	free(save_data);
+#endif
+
+	free(save_path);
+	save_path = NULL;
+	save_data = NULL;
+	save_size = 0;
+}
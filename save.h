@@ -0,0 +1,14 @@
+#ifndef _SAVE_H
+#define _SAVE_H
+
+#include "common.h"
+
+// maps <rom name>.sav as battery backed cartridge ram, returns NULL on failure
+uint8_t *save_open (const char *rom_filename, uint32_t size);
+
+// mappers call it on every cartridge ram write, flushing happens off the emulation thread
+void save_mark_dirty (void);
+
+void save_close (void);
+
+#endif //_SAVE_H
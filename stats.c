@@ -0,0 +1,79 @@
+#include "stats.h"
+
+gb_stats stats;
+
+static const struct {
+	const char *name;
+	const char *help;
+	size_t     offset;
+} stats_counters[] = {
+	{"instructions", "Instructions retired.", offsetof(gb_stats, instructions)},
+	{"cycles", "Clock cycles emulated.", offsetof(gb_stats, cycles)},
+	{"halted_cycles", "Clock cycles spent in HALT.", offsetof(gb_stats, halted_cycles)},
+	{"frames", "Frames finished by the gpu.", offsetof(gb_stats, frames)},
+	{"frames_skipped", "Frame times spent with the LCD off.", offsetof(gb_stats, frames_skipped)},
+	{"bank_switches", "Mapper bank switches.", offsetof(gb_stats, bank_switches)},
+	{"dma_transfers", "OAM DMA transfers started.", offsetof(gb_stats, dma_transfers)},
+	{"vram_writes", "Cpu writes to VRAM.", offsetof(gb_stats, vram_writes)},
+	{"oam_writes", "Cpu writes to OAM.", offsetof(gb_stats, oam_writes)},
+};
+
+static const char *stats_interrupts[STATS_INT_COUNT] = {"vblank", "stat", "timer", "serial", "joypad"};
+
+#define STATS_COUNTER(i) (*(const uint64_t *) ((const char *) &stats + stats_counters[i].offset))
+
+static void stats_write_prometheus (FILE *out) {
+	for (size_t i = 0; i < sizeof(stats_counters)/sizeof(stats_counters[0]); ++i) {
+		fprintf(out, "# HELP gb_%s_total %s\n", stats_counters[i].name, stats_counters[i].help);
+		fprintf(out, "# TYPE gb_%s_total counter\n", stats_counters[i].name);
+		fprintf(out, "gb_%s_total %llu\n", stats_counters[i].name, (unsigned long long) STATS_COUNTER(i));
+	}
+	fprintf(out, "# HELP gb_interrupts_total Interrupts taken.\n");
+	fprintf(out, "# TYPE gb_interrupts_total counter\n");
+	for (int i = 0; i < STATS_INT_COUNT; ++i) {
+		fprintf(out, "gb_interrupts_total{type=\"%s\"} %llu\n", stats_interrupts[i], (unsigned long long) stats.interrupts[i]);
+	}
+}
+
+static void stats_write_json (FILE *out) {
+	fprintf(out, "{");
+	for (size_t i = 0; i < sizeof(stats_counters)/sizeof(stats_counters[0]); ++i) {
+		fprintf(out, "\"%s\": %llu, ", stats_counters[i].name, (unsigned long long) STATS_COUNTER(i));
+	}
+	fprintf(out, "\"interrupts\": {");
+	for (int i = 0; i < STATS_INT_COUNT; ++i) {
+		fprintf(out, "%s\"%s\": %llu", i ? ", " : "", stats_interrupts[i], (unsigned long long) stats.interrupts[i]);
+	}
+	fprintf(out, "}}\n");
+}
+
+bool stats_write (const char *path) {
+	char   temp[1024];
+	size_t length = strlen(path);
+
+	if (snprintf(temp, sizeof(temp), "%s.tmp", path) >= (int) sizeof(temp)) {
+		println("Path \'%s\' is too long", path);
+		return false;
+	}
+
+	FILE *out = fopen(temp, "w");
+	if (out == NULL) {
+		println("Failed to open \'%s\'", temp);
+		return false;
+	}
+	if (length >= 5 && strcmp(path + length - 5, ".json") == 0) {
+		stats_write_json(out);
+	}
+	else {
+		stats_write_prometheus(out);
+	}
+
+	bool ok = !ferror(out);
+	ok = (fclose(out) == 0) && ok;
+	if (!ok || rename(temp, path) != 0) {
+		println("Failed to write \'%s\'", path);
+		remove(temp);
+		return false;
+	}
+	return true;
+}
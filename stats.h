@@ -0,0 +1,39 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include "common.h"
+
+/*
+ * Counters for fleet monitoring. The emulating modules bump them with plain
+ * increments on paths they take anyway, nothing reads them while running.
+ * stats_write saves a snapshot in the Prometheus text format, or as JSON
+ * for paths ending in .json.
+ */
+enum stats_interrupt {
+	STATS_INT_VBLANK,
+	STATS_INT_STAT,
+	STATS_INT_TIMER,
+	STATS_INT_SERIAL,
+	STATS_INT_JOYPAD,
+	STATS_INT_COUNT
+};
+
+typedef struct {
+	uint64_t instructions;   // guest instructions, the same with --fuse, --jit and --aot
+	uint64_t cycles;
+	uint64_t halted_cycles;
+	uint64_t frames;         // frames the gpu finished
+	uint64_t frames_skipped; // frame times spent with the LCD off
+	uint64_t interrupts[STATS_INT_COUNT]; // taken, by vector
+	uint64_t bank_switches;  // rom or ram bank selects that changed the mapping
+	uint64_t dma_transfers;
+	uint64_t vram_writes;    // by the cpu
+	uint64_t oam_writes;     // by the cpu, DMA only counts in dma_transfers
+} gb_stats;
+
+extern gb_stats stats;
+
+// writes path.tmp and renames it over path, so collectors never read half a file
+bool stats_write (const char *path);
+
+#endif /* _STATS_H_ */
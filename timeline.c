@@ -0,0 +1,75 @@
+#include "timeline.h"
+
+typedef struct {
+	const char *name;
+	uint64_t   begin; // SDL performance counter ticks
+	uint64_t   end;
+} timeline_span;
+
+static timeline_span timeline_ring[TIMELINE_EVENTS];
+static uint64_t      timeline_count   = 0;
+static uint64_t      timeline_origin  = 0;
+static bool          timeline_enabled = false;
+static timeline_span timeline_open[TIMELINE_DEPTH];
+static int           timeline_depth   = 0;
+
+void timeline_start (void) {
+	timeline_count   = 0;
+	timeline_depth   = 0;
+	timeline_origin  = SDL_GetPerformanceCounter();
+	timeline_enabled = true;
+}
+
+void timeline_begin (const char *name) {
+	if (!timeline_enabled) {
+		return;
+	}
+	// deeper spans are dropped, their ends still have to match up
+	if (timeline_depth < TIMELINE_DEPTH) {
+		timeline_open[timeline_depth].name  = name;
+		timeline_open[timeline_depth].begin = SDL_GetPerformanceCounter();
+	}
+	timeline_depth++;
+}
+
+void timeline_end (void) {
+	if (!timeline_enabled || timeline_depth == 0) {
+		return;
+	}
+	if (--timeline_depth < TIMELINE_DEPTH) {
+		timeline_span *span = &timeline_ring[timeline_count++ & (TIMELINE_EVENTS - 1)];
+
+		*span     = timeline_open[timeline_depth];
+		span->end = SDL_GetPerformanceCounter();
+	}
+}
+
+bool timeline_write (const char *path) {
+	const double   scale = 1000000.0/SDL_GetPerformanceFrequency(); // trace events are in microseconds
+	const uint64_t first = (timeline_count > TIMELINE_EVENTS) ? timeline_count - TIMELINE_EVENTS : 0;
+
+	FILE *out = fopen(path, "w");
+	if (out == NULL) {
+		println("Failed to open \'%s\'", path);
+		return false;
+	}
+
+	fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"emulator\"}}");
+	for (uint64_t i = first; i < timeline_count; ++i) {
+		const timeline_span *span = &timeline_ring[i & (TIMELINE_EVENTS - 1)];
+
+		fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}", span->name,
+			(span->begin - timeline_origin)*scale, (span->end - span->begin)*scale);
+	}
+	fprintf(out, "\n]}\n");
+
+	bool ok = !ferror(out);
+	ok = (fclose(out) == 0) && ok;
+	if (!ok) {
+		println("Failed to write \'%s\'", path);
+		return false;
+	}
+	println("Wrote %llu frame phase spans to \'%s\'", (unsigned long long) (timeline_count - first), path);
+	return true;
+}
@@ -0,0 +1,26 @@
+#ifndef _TIMELINE_H_
+#define _TIMELINE_H_
+
+#include "common.h"
+
+/*
+ * Host side timeline of frame phases (emulated frame, gpu render calls,
+ * vsync, event polling, sleeping) for Perfetto or chrome://tracing. Spans
+ * go into a ring in memory as complete events and are only formatted by
+ * timeline_write, names have to be string literals. Until timeline_start
+ * begin and end return right away.
+ */
+#define TIMELINE_EVENTS (1 << 20) // power of two, 24MB of ring, about 40 seconds of frames
+#define TIMELINE_DEPTH  8         // spans open at once
+
+void timeline_start (void);
+
+void timeline_begin (const char *name);
+
+// closes the span opened last
+void timeline_end (void);
+
+// Chrome trace event JSON, oldest span first
+bool timeline_write (const char *path);
+
+#endif /* _TIMELINE_H_ */
@@ -1,61 +1,114 @@
 #include "timer.h"
 #include "cpu.h"
+#include "io.h"
 
-static uint16_t timer_divider_increase = 0;
-static uint8_t timer_divider = 0;
+#define TIMER_ENABLE_FLAG 0x4
+#define TIMER_NEVER       UINT64_MAX
 
-static uint32_t timer_counter_increase = 0;
-static uint8_t timer_counter = 0;
+/*
+ * DIV and TIMA are not ticked per instruction, they are derived from the
+ * cpu cycle counter when something looks at them. Both count falling edges
+ * of one internal 16 bit counter, so TIMA period is a power of two and
+ * stays in phase with DIV, resetting DIV also resets the TIMA prescaler.
+ */
+static uint64_t timer_divider_base = 0; // cycle DIV was last reset at
+static uint64_t timer_synced_at = 0;    // cycle timer_counter is valid for
+static uint64_t timer_next_overflow = TIMER_NEVER;
 
+static uint8_t timer_counter = 0;
 static uint8_t timer_ctrl = 0xF8;
 static uint8_t timer_modulo = 0;
 
-void timer_step (int cycles) {
-    timer_divider_increase += cycles;
-    if (timer_divider_increase >= 256) {
-        timer_divider_increase -= 256;
-        timer_divider++;
+// cycles per TIMA tick for TAC 0-3: 4096, 262144, 65536, 16384 Hz
+static const int timer_shift[4] = {10, 4, 6, 8};
+
+static uint8_t timer_read_reg (uint16_t addr);
+
+static void timer_write_reg (uint16_t addr, uint8_t val);
+
+static void timer_restore_reg (uint16_t addr, uint8_t val);
+
+void timer_init (void) {
+    timer_divider_base = cpu_get_cycles();
+    timer_synced_at = timer_divider_base;
+    timer_next_overflow = TIMER_NEVER;
+    timer_counter = 0;
+    timer_ctrl = 0xF8;
+    timer_modulo = 0;
+
+    io_map(0xff04, NULL, 0x00, timer_read_reg, timer_write_reg);
+    io_map(0xff05, NULL, 0x00, timer_read_reg, timer_write_reg);
+    io_map(0xff06, &timer_modulo, 0x00, NULL, timer_write_reg);
+    io_map(0xff07, &timer_ctrl, 0xf8, NULL, timer_write_reg);
+    for (uint16_t addr = 0xff04; addr <= 0xff07; ++addr) {
+        io_map_restore(addr, timer_restore_reg);
     }
+}
+
+// brings timer_counter up to now, reloading and raising the interrupt on every overflow
+static void timer_sync (uint64_t now) {
+    if (timer_ctrl & TIMER_ENABLE_FLAG) {
+        int shift = timer_shift[timer_ctrl & 0x3];
+        uint64_t ticks = ((now - timer_divider_base) >> shift) - ((timer_synced_at - timer_divider_base) >> shift);
+        uint64_t counter = timer_counter + ticks;
 
-    if ((timer_ctrl >> 2) & 0x1) {
-        int timer_increase_by = 0;
-
-        switch((timer_ctrl & 0x3)) {
-        case 0:
-            timer_increase_by = 256;
-            break;
-        case 1:
-            timer_increase_by = 16384;
-            break;
-        case 2:
-            timer_increase_by = 4096;
-            break;
-        case 3:
-            timer_increase_by = 1024;
-            break;
+        while (counter > 0xFF) {
+            counter = counter - 0x100 + timer_modulo;
+            cpu_request_interrupt(2);
         }
+        timer_counter = counter;
+    }
+    timer_synced_at = now;
+}
 
-        timer_counter_increase += (timer_increase_by * cycles);
-        if (timer_counter_increase >= 262144) {
-            timer_counter_increase -= 262144;
-            timer_counter++;
+static void timer_schedule (void) {
+    if (!(timer_ctrl & TIMER_ENABLE_FLAG)) {
+        timer_next_overflow = TIMER_NEVER;
+        return;
+    }
 
-            if (timer_counter == 0) {
-                timer_counter = timer_modulo;
+    int shift = timer_shift[timer_ctrl & 0x3];
+    uint64_t ticks_done = (timer_synced_at - timer_divider_base) >> shift;
+    uint64_t overflow_tick = ticks_done + (0x100 - timer_counter);
 
-                cpu_request_interrupt(2);
-            }
-        }
+    timer_next_overflow = timer_divider_base + (overflow_tick << shift);
+}
+
+void timer_step (void) {
+    uint64_t now = cpu_get_cycles();
+
+    if (now >= timer_next_overflow) {
+        timer_sync(now);
+        timer_schedule();
+    }
+}
+
+static uint8_t timer_read_reg (uint16_t addr) {
+    uint64_t now = cpu_get_cycles();
+
+    switch (addr) {
+    case 0xff04:
+        return (now - timer_divider_base) >> 8;
+    case 0xff05:
+        timer_sync(now);
+        timer_schedule();
+        return timer_counter;
     }
+    return 0xff;
 }
 
-void timer_write_reg (uint16_t addr, uint8_t val) {
+static void timer_write_reg (uint16_t addr, uint8_t val) {
+    uint64_t now = cpu_get_cycles();
+
+    // settle ticks owed under the old settings before changing anything
+    timer_sync(now);
+
     switch (addr) {
     case 0xff04:
-        timer_divider = 0;
+        timer_divider_base = now;
         break;
     case 0xff05:
-        timer_counter = 0;
+        timer_counter = val;
         break;
     case 0xff06:
         timer_modulo = val;
@@ -64,19 +117,29 @@ void timer_write_reg (uint16_t addr, uint8_t val) {
         timer_ctrl = val;
         break;
     }
+
+    timer_schedule();
 }
 
-uint8_t timer_read_reg (uint16_t addr) {
+// state load, nothing is owed under the old settings and DIV restarts from the saved value
+static void timer_restore_reg (uint16_t addr, uint8_t val) {
+    uint64_t now = cpu_get_cycles();
+
     switch (addr) {
     case 0xff04:
-        return timer_divider;
+        timer_divider_base = now - ((uint64_t) val << 8);
+        break;
     case 0xff05:
-        return timer_counter;
+        timer_counter = val;
+        break;
     case 0xff06:
-        return timer_modulo;
+        timer_modulo = val;
+        break;
     case 0xff07:
-        return timer_ctrl;
-    default:
-        return 0xff;
+        timer_ctrl = val;
+        break;
     }
+
+    timer_synced_at = now;
+    timer_schedule();
 }
@@ -3,8 +3,8 @@
 
 #include "common.h"
 
-uint8_t timer_read_reg (uint16_t addr);
-void timer_write_reg (uint16_t addr, uint8_t val);
-void timer_step (int cycles);
+void timer_init (void);
+// cheap when no overflow is due, the timer itself is evaluated lazily on register access
+void timer_step (void);
 
 #endif /* _TIMER_H_ */
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Builds a translated shared object for one rom. The emulator runs the rom
+# once under the interpreter, play through as much of the game as you want
+# covered and close the window, then the written C gets compiled.
+#
+# usage: tools/aot.sh <smallconsole binary> <rom.gb> [out.so]
+set -e
+
+if [ $# -lt 2 ]; then
+	echo "usage: $0 <smallconsole binary> <rom.gb> [out.so]" >&2
+	exit 1
+fi
+
+emulator="$1"
+rom="$2"
+out="${3:-${rom%.*}.so}"
+src="${out%.so}_aot.c"
+repo="$(cd "$(dirname "$0")/.." && pwd)"
+
+"$emulator" --aot-gen "$src" "$rom"
+${CC:-cc} -O2 -shared -fPIC -I"$repo" "$src" -o "$out"
+echo "run with: $emulator --aot $out $rom"
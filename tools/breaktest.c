@@ -0,0 +1,98 @@
+/*
+ * Checks the breakpoint condition compiler and evaluator against a fixed
+ * register state, and that conditions which shouldn't compile don't.
+ *
+ * build: cmake builds it and ctest runs it
+ * usage: breaktest
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "../breakpoint.h"
+#include "../cpu.h"
+#include "../io.h"
+#include "../rom.h"
+
+#define TEST_BANK 5
+
+typedef struct {
+	int        bank;      // -1 for any
+	const char *condition;
+	char       expected;  // '1' hit, '0' no hit, 'x' doesn't compile
+} break_test;
+
+static const break_test tests[] = {
+	{-1, "a == 0x3F && bank == 5",  '1'},
+	{-1, "a == 0x3F && bank == 4",  '0'},
+	{-1, "a==$3f",                  '1'},
+	{-1, "a != 63",                 '0'},
+	{-1, "hl + 1 == 0x1235",        '1'},
+	{-1, "(b | c) == 0xFF",         '0'},
+	{-1, "b & 0x0F",                '1'},
+	{-1, "!(a < 0x40)",             '0'},
+	{-1, "a <= 0x3F && a >= 0x3F",  '1'},
+	{-1, "sp > 0xFFF0 || pc < 0",   '1'},
+	{-1, "[0x1240] == 0x40",        '1'},
+	{-1, "[hl] == 0x34",            '1'},
+	{-1, "a - 0x40 == -1",          '1'},
+	{-1, "1 + 2 == 3 && 2 > 1",     '1'},
+	{-1, "1 | 2 == 2",              '1'},
+	{-1, "bank",                    '1'},
+	{-1, "f == 0xB0",               '1'},
+	{-1, "af == 0x3FB0 && de == 0", '1'},
+	{-1, NULL,                      '1'},
+	{5,  NULL,                      '1'},
+	{4,  NULL,                      '0'},
+	{5,  "a == 0x3F",               '1'},
+	{-1, "a = 3",                   'x'},
+	{-1, "foo == 1",                'x'},
+	{-1, "(a == 1",                 'x'},
+	{-1, "a ==",                    'x'},
+	{-1, "a & & b",                 'x'},
+	{-1, "[hl",                     'x'},
+	{-1, "a * 2",                   'x'},
+};
+
+static uint8_t test_rom[0x8000];
+
+static int hits = 0;
+
+static bool test_handler (int id, const breakpoint_state *state, void *user) {
+	++hits;
+	return true;
+}
+
+int main (int argc, char **argv) {
+	breakpoint_state state = {0x3FB0, 0x12F3, 0x0000, 0x1234, 0xFFFE, 0x0100, TEST_BANK*0x4000 + 0x0100};
+	int              failed = 0;
+	int              count  = sizeof(tests)/sizeof(tests[0]);
+
+	// [addr] reads the bus, rom bytes past the header hold the low byte of their address
+	for (int i = 0x200; i < (int) sizeof(test_rom); ++i) {
+		test_rom[i] = i & 0xFF;
+	}
+	io_init();
+	cpu_init();
+	rom_load("breaktest", test_rom, sizeof(test_rom), 0);
+	breakpoint_set_handler(test_handler, NULL);
+
+	for (int i = 0; i < count; ++i) {
+		const break_test *test = &tests[i];
+		int              id    = breakpoint_add(test->bank, state.pc, test->condition);
+		char             got   = 'x';
+
+		if (id >= 0) {
+			hits = 0;
+			breakpoint_hit(&state);
+			breakpoint_remove(id);
+			got = hits > 0 ? '1' : '0';
+		}
+		if (got != test->expected) {
+			printf("%d:%s gave %c, expected %c\n", test->bank, test->condition ? test->condition : "(none)", got, test->expected);
+			++failed;
+		}
+	}
+
+	printf("%d of %d conditions behave\n", count - failed, count);
+	return failed > 0;
+}
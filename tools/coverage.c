@@ -0,0 +1,162 @@
+/*
+ * Works on coverage files written by smallconsole --coverage.
+ *
+ * build: cc -O2 -o coverage tools/coverage.c (cmake builds it as well)
+ * usage: coverage report <file.cov>
+ *        coverage merge <out.cov> <in.cov>...
+ *
+ * merge ORs the bitmaps of runs of the same rom and adds up their counters,
+ * counters are only kept if every input has them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../coverage.h"
+
+#define BANK_SIZE 0x4000
+
+typedef struct {
+	coverage_header header;
+	uint8_t         *bits;
+	uint32_t        *counts; // NULL unless header.counts
+} coverage_file;
+
+static void coverage_free (coverage_file *file) {
+	free(file->bits);
+	free(file->counts);
+	file->bits   = NULL;
+	file->counts = NULL;
+}
+
+static bool coverage_read (const char *path, coverage_file *file) {
+	file->bits   = NULL;
+	file->counts = NULL;
+
+	FILE *in = fopen(path, "rb");
+	if (in == NULL) {
+		fprintf(stderr, "Failed to open '%s'\n", path);
+		return false;
+	}
+	if (fread(&file->header, sizeof(file->header), 1, in) != 1
+		|| memcmp(file->header.magic, COVERAGE_MAGIC, sizeof(file->header.magic)) != 0) {
+		fprintf(stderr, "'%s' is not a coverage file\n", path);
+		fclose(in);
+		return false;
+	}
+	if (file->header.version != COVERAGE_VERSION) {
+		fprintf(stderr, "'%s' was written by another emulator version\n", path);
+		fclose(in);
+		return false;
+	}
+
+	uint32_t size = file->header.rom_size;
+
+	file->bits   = calloc(size/8, sizeof(uint8_t));
+	file->counts = file->header.counts ? calloc(size, sizeof(uint32_t)) : NULL;
+	if (fread(file->bits, size/8, 1, in) != 1
+		|| (file->counts != NULL && fread(file->counts, sizeof(uint32_t), size, in) != size)) {
+		fprintf(stderr, "'%s' is cut short\n", path);
+		coverage_free(file);
+		fclose(in);
+		return false;
+	}
+	fclose(in);
+	return true;
+}
+
+static int coverage_report (const char *path) {
+	coverage_file file;
+	uint32_t      covered = 0;
+
+	if (!coverage_read(path, &file)) {
+		return 1;
+	}
+
+	printf("rom %04X, %u bytes\n", file.header.rom_checksum, file.header.rom_size);
+	printf(file.counts ? "bank     covered   share    instructions\n" : "bank     covered   share\n");
+	for (uint32_t bank = 0; bank < file.header.rom_size/BANK_SIZE; ++bank) {
+		uint32_t bank_covered = 0;
+		uint64_t executed     = 0;
+
+		for (uint32_t i = bank*BANK_SIZE/8; i < (bank + 1)*BANK_SIZE/8; ++i) {
+			bank_covered += __builtin_popcount(file.bits[i]);
+		}
+		for (uint32_t i = bank*BANK_SIZE; file.counts != NULL && i < (bank + 1)*BANK_SIZE; ++i) {
+			executed += file.counts[i];
+		}
+		covered += bank_covered;
+
+		printf("%02X   %11u %6.2f%%", bank, bank_covered, 100.0*bank_covered/BANK_SIZE);
+		if (file.counts != NULL) {
+			printf(" %15llu", (unsigned long long) executed);
+		}
+		printf("\n");
+	}
+	printf("all  %11u %6.2f%%\n", covered, 100.0*covered/file.header.rom_size);
+	coverage_free(&file);
+	return 0;
+}
+
+static int coverage_merge (const char *out_path, int count, char *paths[]) {
+	coverage_file merged;
+	coverage_file file;
+
+	if (!coverage_read(paths[0], &merged)) {
+		return 1;
+	}
+	for (int i = 1; i < count; ++i) {
+		if (!coverage_read(paths[i], &file)) {
+			coverage_free(&merged);
+			return 1;
+		}
+		if (file.header.rom_size != merged.header.rom_size || file.header.rom_checksum != merged.header.rom_checksum) {
+			fprintf(stderr, "'%s' covers another rom than '%s'\n", paths[i], paths[0]);
+			coverage_free(&file);
+			coverage_free(&merged);
+			return 1;
+		}
+
+		for (uint32_t j = 0; j < merged.header.rom_size/8; ++j) {
+			merged.bits[j] |= file.bits[j];
+		}
+		if (merged.counts != NULL && file.counts != NULL) {
+			for (uint32_t j = 0; j < merged.header.rom_size; ++j) {
+				merged.counts[j] += file.counts[j];
+			}
+		}
+		else {
+			merged.header.counts = 0;
+		}
+		coverage_free(&file);
+	}
+
+	FILE *out = fopen(out_path, "wb");
+	if (out == NULL) {
+		fprintf(stderr, "Failed to open '%s'\n", out_path);
+		coverage_free(&merged);
+		return 1;
+	}
+	uint32_t size = merged.header.rom_size;
+	bool     ok   = fwrite(&merged.header, sizeof(merged.header), 1, out) == 1
+	                && fwrite(merged.bits, size/8, 1, out) == 1
+	                && (!merged.header.counts || fwrite(merged.counts, sizeof(uint32_t), size, out) == size);
+	fclose(out);
+	coverage_free(&merged);
+	if (!ok) {
+		fprintf(stderr, "Failed to write '%s'\n", out_path);
+		return 1;
+	}
+	return 0;
+}
+
+int main (int argc, char *argv[]) {
+	if (argc == 3 && strcmp(argv[1], "report") == 0) {
+		return coverage_report(argv[2]);
+	}
+	if (argc >= 4 && strcmp(argv[1], "merge") == 0) {
+		return coverage_merge(argv[2], argc - 3, argv + 3);
+	}
+	fprintf(stderr, "usage: %s report <file.cov>\n       %s merge <out.cov> <in.cov>...\n", argv[0], argv[0]);
+	return 1;
+}
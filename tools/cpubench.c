@@ -0,0 +1,72 @@
+/*
+ * Times the interpreter on a loop of random CB prefixed instructions in
+ * WRAM, the case the table driven CB handlers were written for. The time
+ * includes the fetch, cycle lookup and interrupt check of cpu_step. Build
+ * the same file on two commits to compare them.
+ *
+ * build: cmake builds it, it includes cpu.c to set up ram and registers
+ * usage: cpubench [steps]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../cpu.c"
+#include "../io.h"
+#include "../rom.h"
+#include "../timer.h"
+
+#define BENCH_OPS   2048     // CB instructions in the loop
+#define BENCH_STEPS 50000000
+#define BENCH_DATA  0xD800   // (hl) operand, away from the code
+
+static uint8_t bench_rom[0x8000];
+
+static uint64_t bench_state = 88172645463325252ULL;
+
+static uint64_t bench_random (void) {
+	bench_state ^= bench_state << 13;
+	bench_state ^= bench_state >> 7;
+	bench_state ^= bench_state << 17;
+	return bench_state;
+}
+
+int main (int argc, char **argv) {
+	long            steps = argc > 1 ? atol(argv[1]) : BENCH_STEPS;
+	struct timespec begin, end;
+	double          elapsed;
+
+	io_init();
+	timer_init();
+	cpu_init();
+	rom_load("cpubench", bench_rom, sizeof(bench_rom), 0);
+	cpu.boot_rom_enabled = false;
+
+	for (int i = 0; i < BENCH_OPS; ++i) {
+		uint8_t op = bench_random();
+
+		// only BIT leaves h and l alone, the rest would move (hl) out of the data page
+		if ((op < 0x40 || op >= 0x80) && ((op & 0x7) == 4 || (op & 0x7) == 5)) {
+			op |= 0x7;
+		}
+		iram[i*2]     = 0xCB;
+		iram[i*2 + 1] = op;
+	}
+	// JP 0xC000
+	iram[BENCH_OPS*2]     = 0xC3;
+	iram[BENCH_OPS*2 + 1] = 0x00;
+	iram[BENCH_OPS*2 + 2] = 0xC0;
+
+	cpu.pc = 0xC000;
+	cpu.hl = BENCH_DATA;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (long i = 0; i < steps; ++i) {
+		cpu_step();
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	elapsed = (end.tv_sec - begin.tv_sec)*1e9 + (end.tv_nsec - begin.tv_nsec);
+	printf("%ld steps, %.2f ns per instruction (a=%02x)\n", steps, elapsed/steps, cpu.a);
+	return 0;
+}
@@ -0,0 +1,225 @@
+/*
+ * Instruction level regression test for the cpu core. Every opcode, and
+ * every CB opcode, runs from WRAM with random registers and memory,
+ * followed by a random instruction that reads the flags (conditional
+ * branch, ADC/SBC, DAA, PUSH AF, rotate through carry). Registers,
+ * flags, cycles and the memory the pair can touch are hashed per opcode
+ * and compared against a corpus of hashes recorded from a known good core.
+ *
+ * build: cmake builds it and ctest runs it, it includes cpu.c to set up
+ *        ram and registers
+ * usage: cputest <corpus>          check, lists opcodes that differ
+ *        cputest --write <corpus>  record the corpus from this core
+ *
+ * Every opcode starts from fresh WRAM and HRAM, io state still carries
+ * over, so after a real regression the first opcode listed is the one
+ * to look at.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../cpu.c"
+#include "../io.h"
+#include "../rom.h"
+#include "../timer.h"
+
+#define TEST_OPCODES 512  // 0x000-0x0FF plain, 0x100-0x1FF CB prefixed
+#define TEST_CASES   256  // random starts per opcode
+#define TEST_CODE    0xDF00
+
+static uint8_t test_rom[0x8000];
+
+static uint64_t test_state;
+
+static uint64_t test_random (void) {
+	test_state ^= test_state << 13;
+	test_state ^= test_state >> 7;
+	test_state ^= test_state << 17;
+	return test_state;
+}
+
+static uint64_t test_mix (uint64_t hash, uint64_t val) {
+	return (hash ^ val)*1099511628211ULL;
+}
+
+// the ones cpu.c only logs CHECKME for
+static bool test_undefined (uint8_t opcode) {
+	switch (opcode) {
+	case 0xD3: case 0xDB: case 0xDD: case 0xE3: case 0xE4: case 0xEB:
+	case 0xEC: case 0xED: case 0xF4: case 0xFC: case 0xFD:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// instructions whose result depends on the flags left behind
+static const uint8_t test_readers[] = {
+	0x20, 0x28, 0x30, 0x38, // JR cc
+	0xC2, 0xCA, 0xD2, 0xDA, // JP cc
+	0xC4, 0xCC, 0xD4, 0xDC, // CALL cc
+	0xC0, 0xC8, 0xD0, 0xD8, // RET cc
+	0x88, 0x89, 0x8E, 0x8F, 0xCE, // ADC
+	0x98, 0x99, 0x9E, 0x9F, 0xDE, // SBC
+	0x27, // DAA
+	0xF5, // PUSH AF
+	0x17, 0x1F, 0x3F, // RLA, RRA, CCF
+	0xCB  // RL/RR r
+};
+
+static uint64_t test_ram_hash (uint64_t hash, uint16_t addr) {
+	if ((addr >= 0xC000 && addr <= 0xDFFF) || (addr >= 0xFF80 && addr <= 0xFFFE)) {
+		hash = test_mix(hash, read_byte_bus(addr));
+	}
+	return hash;
+}
+
+static uint64_t test_opcode (int index) {
+	uint64_t hash = 14695981039346656037ULL;
+
+	test_state = 0x9E3779B97F4A7C15ULL + index;
+	for (int i = 0; i < (int) sizeof(iram); ++i) {
+		iram[i] = test_random();
+	}
+	for (int i = 0; i < (int) sizeof(zeropage); ++i) {
+		zeropage[i] = test_random();
+	}
+	cpu_invalidate_blocks();
+
+	for (int i = 0; i < TEST_CASES; ++i) {
+		uint64_t r      = test_random();
+		uint8_t  reader = test_readers[test_random() % sizeof(test_readers)];
+		uint8_t  code[6];
+		int      length = index < 0x100 ? instruction_length[index] : 2;
+		uint16_t start_bc, start_de, start_hl, start_sp;
+
+		for (int k = 0; k < (int) sizeof(code); ++k) {
+			code[k] = test_random();
+		}
+		code[0] = index < 0x100 ? index : 0xCB;
+		if (index >= 0x100) {
+			code[1] = index - 0x100;
+		}
+		// the reader goes right behind the opcode, branches may still skip it
+		code[length] = reader;
+		if (reader == 0xCB) {
+			code[length + 1] = 0x10 | (code[length + 1] & 0xF);
+		}
+
+		cpu.af = r & 0xFFF0;
+		cpu.flags_op = FLAGS_NONE;
+		cpu.bc = r >> 16;
+		cpu.de = r >> 32;
+		cpu.hl = 0xC000 | ((r >> 48) & 0x1FFF);
+		// the stack stays below the code, CALL pushing over its own operand is a different test
+		cpu.sp = 0xD000 | (test_random() & 0xEFE);
+		cpu.pc = TEST_CODE;
+		cpu.halted = false;
+		cpu.stop = false;
+		cpu.ime = false;
+		cpu.ime_delay = 0;
+		cpu.interrupt_enable = 0x00;
+		cpu.interrupt_flag = 0xE0;
+		cpu_update_interrupts();
+
+		for (int k = 0; k < (int) sizeof(code); ++k) {
+			write_byte(TEST_CODE + k, code[k]);
+		}
+
+		start_bc = cpu.bc;
+		start_de = cpu.de;
+		start_hl = cpu.hl;
+		start_sp = cpu.sp;
+
+		hash = test_mix(hash, cpu_step());
+		hash = test_mix(hash, cpu_step());
+		cpu_flags_sync();
+
+		hash = test_mix(hash, cpu.af);
+		hash = test_mix(hash, cpu.bc);
+		hash = test_mix(hash, cpu.de);
+		hash = test_mix(hash, cpu.hl);
+		hash = test_mix(hash, cpu.sp);
+		hash = test_mix(hash, cpu.pc);
+		hash = test_mix(hash, cpu.ime | cpu.ime_delay << 1 | cpu.halted << 4 | cpu.stop << 5);
+
+		hash = test_ram_hash(hash, start_bc);
+		hash = test_ram_hash(hash, start_de);
+		for (int k = -1; k <= 1; ++k) {
+			hash = test_ram_hash(hash, start_hl + k);
+		}
+		for (int k = -4; k <= 1; ++k) {
+			hash = test_ram_hash(hash, start_sp + k);
+		}
+		hash = test_ram_hash(hash, code[1] | code[2] << 8);
+		hash = test_ram_hash(hash, 0xFF00 | code[1]);
+	}
+	return hash;
+}
+
+static void test_name (int index, char *name) {
+	if (index < 0x100) {
+		sprintf(name, "%02X", index);
+	}
+	else {
+		sprintf(name, "CB%02X", index - 0x100);
+	}
+}
+
+int main (int argc, char **argv) {
+	bool     write  = argc == 3 && strcmp(argv[1], "--write") == 0;
+	FILE     *file  = NULL;
+	int      failed = 0;
+	int      tested = 0;
+
+	if (argc != 2 && !write) {
+		printf("usage: %s [--write] <corpus>\n", argv[0]);
+		return 2;
+	}
+
+	io_init();
+	timer_init();
+	cpu_init();
+	rom_load("cputest", test_rom, sizeof(test_rom), 0);
+	cpu.boot_rom_enabled = false;
+
+	file = fopen(argv[argc - 1], write ? "w" : "r");
+	if (file == NULL) {
+		printf("Failed to open corpus \'%s\'\n", argv[argc - 1]);
+		return 2;
+	}
+
+	for (int i = 0; i < TEST_OPCODES; ++i) {
+		char               name[8], expected_name[8];
+		uint64_t           hash;
+		unsigned long long expected;
+
+		if (i < 0x100 && test_undefined(i)) {
+			continue;
+		}
+		test_name(i, name);
+		hash = test_opcode(i);
+
+		if (write) {
+			fprintf(file, "%s %016llx\n", name, (unsigned long long) hash);
+			continue;
+		}
+		if (fscanf(file, "%7s %llx", expected_name, &expected) != 2 || strcmp(name, expected_name) != 0) {
+			printf("Corpus doesn't match the opcode list at %s\n", name);
+			fclose(file);
+			return 2;
+		}
+		++tested;
+		if (hash != expected) {
+			printf("%s differs: %016llx, expected %016llx\n", name, (unsigned long long) hash, expected);
+			++failed;
+		}
+	}
+
+	fclose(file);
+	if (!write) {
+		printf("%d of %d opcodes match the corpus\n", tested - failed, tested);
+	}
+	return failed > 0;
+}
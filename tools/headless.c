@@ -0,0 +1,36 @@
+/*
+ * Stands in for the SDL frontend of common.c, so tools can link the
+ * emulator core and drive it without a window. Logging goes to stdout,
+ * the screen is dropped.
+ */
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "../common.h"
+
+void println (const char *message, ...) {
+	va_list arg;
+
+	va_start(arg, message);
+	vprintf(message, arg);
+	va_end(arg);
+
+	printf("\n");
+}
+
+void printl (const char *message, ...) {
+	va_list arg;
+
+	va_start(arg, message);
+	vprintf(message, arg);
+	va_end(arg);
+}
+
+void screen_clear (void) {
+}
+
+void screen_vsync (void) {
+}
+
+void screen_put_pixel (int x, int y, uint8_t r, uint8_t g, uint8_t b) {
+}
@@ -0,0 +1,181 @@
+/*
+ * Disassembles an instruction trace written by smallconsole --trace, one
+ * line per instruction, oldest first. Registers are the ones the
+ * instruction started with.
+ *
+ * build: cc -O2 -o tracedump tools/tracedump.c (cmake builds it as well)
+ * usage: tracedump <file> [last n]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../trace.h"
+
+#define LOCATION_BUS 0x80000000u // CPU_LOCATION_BUS of cpu.h
+
+// d8, d16, a8, a16 and r8 get replaced by the operand
+static const char *mnemonics[256] = {
+	"NOP",         "LD BC,d16",   "LD (BC),A",   "INC BC",     "INC B",       "DEC B",     "LD B,d8",     "RLCA",
+	"LD (a16),SP", "ADD HL,BC",   "LD A,(BC)",   "DEC BC",     "INC C",       "DEC C",     "LD C,d8",     "RRCA",
+	"STOP",        "LD DE,d16",   "LD (DE),A",   "INC DE",     "INC D",       "DEC D",     "LD D,d8",     "RLA",
+	"JR r8",       "ADD HL,DE",   "LD A,(DE)",   "DEC DE",     "INC E",       "DEC E",     "LD E,d8",     "RRA",
+	"JR NZ,r8",    "LD HL,d16",   "LD (HL+),A",  "INC HL",     "INC H",       "DEC H",     "LD H,d8",     "DAA",
+	"JR Z,r8",     "ADD HL,HL",   "LD A,(HL+)",  "DEC HL",     "INC L",       "DEC L",     "LD L,d8",     "CPL",
+	"JR NC,r8",    "LD SP,d16",   "LD (HL-),A",  "INC SP",     "INC (HL)",    "DEC (HL)",  "LD (HL),d8",  "SCF",
+	"JR C,r8",     "ADD HL,SP",   "LD A,(HL-)",  "DEC SP",     "INC A",       "DEC A",     "LD A,d8",     "CCF",
+	"LD B,B",      "LD B,C",      "LD B,D",      "LD B,E",     "LD B,H",      "LD B,L",    "LD B,(HL)",   "LD B,A",
+	"LD C,B",      "LD C,C",      "LD C,D",      "LD C,E",     "LD C,H",      "LD C,L",    "LD C,(HL)",   "LD C,A",
+	"LD D,B",      "LD D,C",      "LD D,D",      "LD D,E",     "LD D,H",      "LD D,L",    "LD D,(HL)",   "LD D,A",
+	"LD E,B",      "LD E,C",      "LD E,D",      "LD E,E",     "LD E,H",      "LD E,L",    "LD E,(HL)",   "LD E,A",
+	"LD H,B",      "LD H,C",      "LD H,D",      "LD H,E",     "LD H,H",      "LD H,L",    "LD H,(HL)",   "LD H,A",
+	"LD L,B",      "LD L,C",      "LD L,D",      "LD L,E",     "LD L,H",      "LD L,L",    "LD L,(HL)",   "LD L,A",
+	"LD (HL),B",   "LD (HL),C",   "LD (HL),D",   "LD (HL),E",  "LD (HL),H",   "LD (HL),L", "HALT",        "LD (HL),A",
+	"LD A,B",      "LD A,C",      "LD A,D",      "LD A,E",     "LD A,H",      "LD A,L",    "LD A,(HL)",   "LD A,A",
+	"ADD A,B",     "ADD A,C",     "ADD A,D",     "ADD A,E",    "ADD A,H",     "ADD A,L",   "ADD A,(HL)",  "ADD A,A",
+	"ADC A,B",     "ADC A,C",     "ADC A,D",     "ADC A,E",    "ADC A,H",     "ADC A,L",   "ADC A,(HL)",  "ADC A,A",
+	"SUB B",       "SUB C",       "SUB D",       "SUB E",      "SUB H",       "SUB L",     "SUB (HL)",    "SUB A",
+	"SBC A,B",     "SBC A,C",     "SBC A,D",     "SBC A,E",    "SBC A,H",     "SBC A,L",   "SBC A,(HL)",  "SBC A,A",
+	"AND B",       "AND C",       "AND D",       "AND E",      "AND H",       "AND L",     "AND (HL)",    "AND A",
+	"XOR B",       "XOR C",       "XOR D",       "XOR E",      "XOR H",       "XOR L",     "XOR (HL)",    "XOR A",
+	"OR B",        "OR C",        "OR D",        "OR E",       "OR H",        "OR L",      "OR (HL)",     "OR A",
+	"CP B",        "CP C",        "CP D",        "CP E",       "CP H",        "CP L",      "CP (HL)",     "CP A",
+	"RET NZ",      "POP BC",      "JP NZ,a16",   "JP a16",     "CALL NZ,a16", "PUSH BC",   "ADD A,d8",    "RST 00H",
+	"RET Z",       "RET",         "JP Z,a16",    "PREFIX CB",  "CALL Z,a16",  "CALL a16",  "ADC A,d8",    "RST 08H",
+	"RET NC",      "POP DE",      "JP NC,a16",   "DB D3",      "CALL NC,a16", "PUSH DE",   "SUB d8",      "RST 10H",
+	"RET C",       "RETI",        "JP C,a16",    "DB DB",      "CALL C,a16",  "DB DD",     "SBC A,d8",    "RST 18H",
+	"LDH (a8),A",  "POP HL",      "LD (C),A",    "DB E3",      "DB E4",       "PUSH HL",   "AND d8",      "RST 20H",
+	"ADD SP,r8",   "JP (HL)",     "LD (a16),A",  "DB EB",      "DB EC",       "DB ED",     "XOR d8",      "RST 28H",
+	"LDH A,(a8)",  "POP AF",      "LD A,(C)",    "DI",         "DB F4",       "PUSH AF",   "OR d8",       "RST 30H",
+	"LD HL,SP+r8", "LD SP,HL",    "LD A,(a16)",  "EI",         "DB FC",       "DB FD",     "CP d8",       "RST 38H"
+};
+
+static const char *cb_operations[] = {"RLC", "RRC", "RL", "RR", "SLA", "SRA", "SWAP", "SRL"};
+static const char *cb_registers[]  = {"B", "C", "D", "E", "H", "L", "(HL)", "A"};
+
+static int instruction_length (uint8_t opcode) {
+	const char *format = mnemonics[opcode];
+
+	if (opcode == 0xCB) {
+		return 2;
+	}
+	if (strstr(format, "d16") != NULL || strstr(format, "a16") != NULL) {
+		return 3;
+	}
+	return (strstr(format, "d8") != NULL || strstr(format, "a8") != NULL || strstr(format, "r8") != NULL) ? 2 : 1;
+}
+
+static void disassemble (const trace_record *record, char *out, size_t size) {
+	uint8_t    d8      = record->imm & 0xFF;
+	const char *format = mnemonics[record->opcode];
+	size_t     length  = 0;
+
+	if (record->opcode == 0xCB) {
+		if (d8 < 0x40) {
+			snprintf(out, size, "%s %s", cb_operations[d8 >> 3], cb_registers[d8 & 7]);
+		}
+		else {
+			static const char *bit_operations[] = {"BIT", "RES", "SET"};
+			snprintf(out, size, "%s %d,%s", bit_operations[(d8 >> 6) - 1], (d8 >> 3) & 7, cb_registers[d8 & 7]);
+		}
+		return;
+	}
+
+	while (*format != '\0' && length + 1 < size) {
+		int written = 0;
+
+		if (strncmp(format, "d16", 3) == 0 || strncmp(format, "a16", 3) == 0) {
+			written = snprintf(out + length, size - length, "$%04X", record->imm);
+			format += 3;
+		}
+		else if (strncmp(format, "d8", 2) == 0) {
+			written = snprintf(out + length, size - length, "$%02X", d8);
+			format += 2;
+		}
+		else if (strncmp(format, "a8", 2) == 0) {
+			written = snprintf(out + length, size - length, "$FF%02X", d8);
+			format += 2;
+		}
+		else if (strncmp(format, "r8", 2) == 0) {
+			// jumps show the target, ADD SP and LD HL,SP+ the signed offset
+			if (record->opcode == 0xE8 || record->opcode == 0xF8) {
+				written = snprintf(out + length, size - length, "%d", (int8_t) d8);
+			}
+			else {
+				written = snprintf(out + length, size - length, "$%04X", (uint16_t) (record->pc + 2 + (int8_t) d8));
+			}
+			format += 2;
+		}
+		else {
+			out[length] = *format++;
+			written = 1;
+		}
+		if (written < 0 || length + written >= size) {
+			break;
+		}
+		length += written;
+	}
+	out[length] = '\0';
+}
+
+static void location_name (uint32_t location, char *name, size_t size) {
+	if (location & LOCATION_BUS) {
+		snprintf(name, size, "  :%04X", location & 0xFFFF);
+	}
+	else {
+		uint32_t bank = location >> 14;
+		snprintf(name, size, "%02X:%04X", bank, (bank ? 0x4000 : 0x0000) | (location & 0x3FFF));
+	}
+}
+
+int main (int argc, char *argv[]) {
+	trace_header header;
+	trace_record record;
+	uint64_t     skip = 0;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <file> [last n]\n", argv[0]);
+		return 1;
+	}
+
+	FILE *in = fopen(argv[1], "rb");
+	if (in == NULL) {
+		fprintf(stderr, "Failed to open '%s'\n", argv[1]);
+		return 1;
+	}
+	if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) {
+		fprintf(stderr, "'%s' is not an instruction trace\n", argv[1]);
+		return 1;
+	}
+	if (header.version != TRACE_VERSION || header.record_size != sizeof(trace_record)) {
+		fprintf(stderr, "'%s' was written by another emulator version\n", argv[1]);
+		return 1;
+	}
+	if (argc > 2) {
+		uint64_t last = strtoull(argv[2], NULL, 0);
+		skip = (last < header.count) ? header.count - last : 0;
+	}
+
+	printf("; %llu instructions traced, the last %llu follow\n",
+		(unsigned long long) header.executed, (unsigned long long) (header.count - skip));
+	printf(";       cycles  bank:pc  bytes     instruction         AF   BC   DE   HL   SP\n");
+	fseek(in, (long) (skip*sizeof(trace_record)), SEEK_CUR);
+	while (fread(&record, sizeof(record), 1, in) == 1) {
+		uint8_t bytes[3] = {record.opcode, record.imm & 0xFF, record.imm >> 8};
+		char    text[32];
+		char    name[16];
+		char    hex[16] = "";
+		int     shown   = instruction_length(record.opcode);
+
+		for (int i = 0; i < shown; ++i) {
+			snprintf(hex + 3*i, sizeof(hex) - 3*i, "%02X ", bytes[i]);
+		}
+		disassemble(&record, text, sizeof(text));
+		location_name(record.location, name, sizeof(name));
+		// fused ops cover more bytes than the first instruction, the rest ran as part of it
+		printf("%14llu  %s  %-9s %-18s  %04X %04X %04X %04X %04X%s\n", (unsigned long long) record.cycles, name, hex,
+			text, record.af, record.bc, record.de, record.hl, record.sp, (record.len > shown) ? "  fused" : "");
+	}
+	fclose(in);
+	return 0;
+}
@@ -0,0 +1,90 @@
+#include "common.h"
+#include "trace.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef TRACE_CRASH_DUMP
+#include <signal.h>
+#endif
+
+// the emulator is single threaded, the writer only ever bumps trace_executed and never waits on anything
+static trace_record trace_ring[TRACE_RECORDS];
+static uint64_t     trace_executed = 0;
+static const char   *trace_path    = NULL;
+
+#ifdef TRACE_CRASH_DUMP
+static const int trace_signals[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+
+static void trace_crash (int sig) {
+	static const char message[] = "Crashed, instruction trace dumped\n";
+
+	if (trace_dump()) {
+		ssize_t unused = write(STDERR_FILENO, message, sizeof(message) - 1);
+		(void) unused;
+	}
+	// handlers were reset on entry, this ends the process the way it would have ended anyway
+	raise(sig);
+}
+#endif
+
+void trace_start (const char *path) {
+	trace_path     = path;
+	trace_executed = 0;
+
+#ifdef TRACE_CRASH_DUMP
+	struct sigaction action = {0};
+
+	action.sa_handler = trace_crash;
+	action.sa_flags   = SA_RESETHAND;
+	sigemptyset(&action.sa_mask);
+	for (size_t i = 0; i < sizeof(trace_signals)/sizeof(trace_signals[0]); ++i) {
+		sigaction(trace_signals[i], &action, NULL);
+	}
+#endif
+}
+
+trace_record *trace_next (void) {
+	return &trace_ring[trace_executed++ & (TRACE_RECORDS - 1)];
+}
+
+static bool trace_write_all (int fd, const void *data, size_t size) {
+	const uint8_t *bytes = data;
+
+	while (size > 0) {
+		ssize_t written = write(fd, bytes, size);
+
+		if (written <= 0) {
+			return false;
+		}
+		bytes += written;
+		size  -= written;
+	}
+	return true;
+}
+
+bool trace_dump (void) {
+	uint64_t     executed = trace_executed;
+	uint64_t     count    = (executed < TRACE_RECORDS) ? executed : TRACE_RECORDS;
+	uint64_t     oldest   = (executed - count) & (TRACE_RECORDS - 1);
+	trace_header header   = {TRACE_MAGIC, TRACE_VERSION, sizeof(trace_record), executed, count};
+	bool         ok;
+
+	if (trace_path == NULL) {
+		return false;
+	}
+
+	// no stdio in here, this also runs from the crash handler
+	int fd = open(trace_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return false;
+	}
+
+	// oldest records run to the end of the ring, the rest wrapped around to its start
+	uint64_t tail = (oldest + count > TRACE_RECORDS) ? TRACE_RECORDS - oldest : count;
+
+	ok = trace_write_all(fd, &header, sizeof(header))
+	     && trace_write_all(fd, &trace_ring[oldest], tail*sizeof(trace_record))
+	     && trace_write_all(fd, &trace_ring[0], (count - tail)*sizeof(trace_record));
+	close(fd);
+	return ok;
+}
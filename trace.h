@@ -0,0 +1,56 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Instruction trace. cpu.c fills one fixed size record per executed
+ * instruction into a ring holding the last TRACE_RECORDS of them, nothing
+ * is formatted or written while the game runs. The ring goes to disk on
+ * request or when the emulator crashes, tools/tracedump.c disassembles it.
+ * Only this header is shared with the decoder, so the file layout lives here.
+ */
+#if !defined(__EMSCRIPTEN__) && !defined(_WIN32)
+#define TRACE_CRASH_DUMP
+#endif
+
+#define TRACE_MAGIC   "GBTRACE" // 8 bytes with the terminator
+#define TRACE_VERSION 1
+#define TRACE_RECORDS (1 << 20) // power of two, 32MB of ring
+
+typedef struct {
+	uint64_t cycles;   // master clock before the instruction ran
+	uint32_t location; // cpu_location of pc, rom image offset or 0x80000000 | pc
+	uint16_t pc;
+	uint16_t af;
+	uint16_t bc;
+	uint16_t de;
+	uint16_t hl;
+	uint16_t sp;
+	uint8_t  opcode;
+	uint8_t  len;      // bytes the instruction covers, fused ops cover several
+	uint16_t imm;      // operand bytes, little endian
+	uint8_t  imm2;     // third operand byte of fused ops
+	uint8_t  unused[3];
+} trace_record;
+
+// file header, the records follow oldest first, all in host byte order
+typedef struct {
+	char     magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint64_t executed;    // instructions traced in total, the file keeps the last count of them
+	uint64_t count;
+} trace_header;
+
+// path is where trace_dump writes, a crash dumps there as well
+void trace_start (const char *path);
+
+// slot for the next record, overwrites the oldest one once the ring is full
+trace_record *trace_next (void);
+
+// async signal safe, so the crash handler can call it too
+bool trace_dump (void);
+
+#endif /* _TRACE_H_ */
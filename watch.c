@@ -0,0 +1,108 @@
+#include "watch.h"
+#include "cpu.h"
+
+typedef struct {
+	bool     used;
+	uint16_t begin;
+	uint16_t end;
+	uint8_t  kinds;
+} watch_range;
+
+static watch_range   watch_ranges[WATCH_MAX];
+static uint8_t       watch_page_kinds[0x100];
+static watch_handler watch_callback = NULL;
+static void          *watch_user    = NULL;
+
+static void watch_update_pages (void) {
+	bool any = false;
+
+	memset(watch_page_kinds, 0x00, sizeof(watch_page_kinds));
+	for (int i = 0; i < WATCH_MAX; ++i) {
+		if (!watch_ranges[i].used) {
+			continue;
+		}
+		for (int page = watch_ranges[i].begin >> 8; page <= watch_ranges[i].end >> 8; ++page) {
+			watch_page_kinds[page] |= watch_ranges[i].kinds;
+		}
+		any = true;
+	}
+	cpu_set_watched(any);
+}
+
+int watch_add (uint16_t begin, uint16_t end, uint8_t kinds) {
+	if (end < begin || (kinds & (WATCH_READ | WATCH_WRITE | WATCH_CHANGE)) == 0) {
+		return -1;
+	}
+	for (int i = 0; i < WATCH_MAX; ++i) {
+		if (!watch_ranges[i].used) {
+			watch_ranges[i] = (watch_range) {true, begin, end, kinds};
+			watch_update_pages();
+			return i;
+		}
+	}
+	return -1;
+}
+
+void watch_remove (int id) {
+	if (id >= 0 && id < WATCH_MAX) {
+		watch_ranges[id].used = false;
+		watch_update_pages();
+	}
+}
+
+void watch_clear (void) {
+	memset(watch_ranges, 0x00, sizeof(watch_ranges));
+	watch_update_pages();
+}
+
+void watch_set_handler (watch_handler handler, void *user) {
+	watch_callback = handler;
+	watch_user     = user;
+}
+
+const uint8_t *watch_pages (void) {
+	return watch_page_kinds;
+}
+
+static void watch_print (const watch_hit *hit) {
+	static const char *names[] = {"", "read", "write", "", "change"};
+	uint32_t          bank     = hit->location >> 14;
+
+	if (hit->location & CPU_LOCATION_BUS) {
+		println("watch %d: %s 0x%04x %02x -> %02x at 0x%04x", hit->id, names[hit->kind], hit->addr,
+			hit->old_value, hit->new_value, hit->pc);
+	}
+	else {
+		println("watch %d: %s 0x%04x %02x -> %02x at %02x:0x%04x", hit->id, names[hit->kind], hit->addr,
+			hit->old_value, hit->new_value, bank, hit->pc);
+	}
+}
+
+static void watch_check (uint8_t kind, uint16_t addr, uint8_t old_value, uint8_t new_value, uint16_t pc, uint32_t location) {
+	for (int i = 0; i < WATCH_MAX; ++i) {
+		const watch_range *range = &watch_ranges[i];
+
+		if (!range->used || !(range->kinds & kind) || addr < range->begin || addr > range->end) {
+			continue;
+		}
+
+		watch_hit hit = {i, kind, addr, pc, location, old_value, new_value};
+		if (watch_callback != NULL) {
+			watch_callback(&hit, watch_user);
+		}
+		else {
+			watch_print(&hit);
+		}
+	}
+}
+
+void watch_read (uint16_t addr, uint8_t val, uint16_t pc, uint32_t location) {
+	watch_check(WATCH_READ, addr, val, val, pc, location);
+}
+
+void watch_write (uint16_t addr, uint8_t old_value, uint8_t new_value, uint16_t pc, uint32_t location) {
+	watch_check(WATCH_WRITE, addr, old_value, new_value, pc, location);
+	if (old_value != new_value) {
+		watch_check(WATCH_CHANGE, addr, old_value, new_value, pc, location);
+	}
+}
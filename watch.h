@@ -0,0 +1,50 @@
+#ifndef _WATCH_H_
+#define _WATCH_H_
+
+#include "common.h"
+
+/*
+ * Memory watchpoints on cpu address ranges. read_byte and write_byte only
+ * leave their fast path while a watchpoint is set, and then only call in
+ * here for 256 byte pages that hold one. Instruction fetches and OAM DMA
+ * don't count as reads.
+ */
+#define WATCH_MAX 32
+
+enum watch_kind {
+	WATCH_READ   = 0x01,
+	WATCH_WRITE  = 0x02,
+	WATCH_CHANGE = 0x04, // writes that change the value
+};
+
+typedef struct {
+	int      id;
+	uint8_t  kind;      // the kind that fired
+	uint16_t addr;
+	uint16_t pc;        // opcode doing the access, the first one of a translated block
+	uint32_t location;  // cpu_location of pc
+	uint8_t  old_value; // equals new_value for reads
+	uint8_t  new_value;
+} watch_hit;
+
+typedef void (*watch_handler) (const watch_hit *hit, void *user);
+
+// watches begin to end inclusive for the watch_kind bits in kinds, returns its id or -1 when all are taken
+int watch_add (uint16_t begin, uint16_t end, uint8_t kinds);
+
+void watch_remove (int id);
+
+void watch_clear (void);
+
+// handler runs right after the access, NULL prints hits
+void watch_set_handler (watch_handler handler, void *user);
+
+// watch_kind bits set somewhere in each 256 byte page
+const uint8_t *watch_pages (void);
+
+// location is cpu_location of pc, taken before the access could switch banks
+void watch_read (uint16_t addr, uint8_t val, uint16_t pc, uint32_t location);
+
+void watch_write (uint16_t addr, uint8_t old_value, uint8_t new_value, uint16_t pc, uint32_t location);
+
+#endif /* _WATCH_H_ */